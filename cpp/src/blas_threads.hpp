@@ -0,0 +1,74 @@
+#ifndef _blas_threads_hpp_
+#define _blas_threads_hpp_
+
+#include <omp.h>
+
+// thread control functions of the common multithreaded BLAS/LAPACK libraries. they are declared weak so that they resolve \
+   to nullptr when the linked library does not provide them.
+extern "C" {
+  void openblas_set_num_threads(int) __attribute__((weak));
+  int openblas_get_num_threads() __attribute__((weak));
+  void MKL_Set_Num_Threads(int) __attribute__((weak));
+  int MKL_Get_Max_Threads() __attribute__((weak));
+}
+
+// limits BLAS/LAPACK to a single thread and disables nested openmp parallelism for the lifetime of the object. this is \
+   meant to wrap openmp parallel regions whose threads call BLAS/LAPACK routines themselves, so that a multithreaded \
+   library does not oversubscribe the cores. the previous settings are restored by restore() or in the destructor. inside \
+   an active parallel region the object does nothing, because the settings belong to the enclosing region.
+class single_threaded_blas
+{
+private:
+  int _max_active_levels; // maximum number of nested active parallel regions before the object was created
+  int _openblas_threads = 0; // number of openblas threads before the object was created, 0 if openblas is not linked
+  int _mkl_threads = 0; // number of mkl threads before the object was created, 0 if mkl is not linked
+  bool _restored = false; // true if the previous settings are already restored
+
+public:
+  single_threaded_blas()
+  {
+    if (omp_in_parallel()){
+      _restored = true;
+      return;
+    }
+
+    _max_active_levels = omp_get_max_active_levels();
+    omp_set_max_active_levels(1);
+
+    if (openblas_set_num_threads != nullptr and openblas_get_num_threads != nullptr){
+      _openblas_threads = openblas_get_num_threads();
+      openblas_set_num_threads(1);
+    }
+
+    if (MKL_Set_Num_Threads != nullptr and MKL_Get_Max_Threads != nullptr){
+      _mkl_threads = MKL_Get_Max_Threads();
+      MKL_Set_Num_Threads(1);
+    }
+  };
+
+  single_threaded_blas(const single_threaded_blas&) = delete;
+  single_threaded_blas& operator=(const single_threaded_blas&) = delete;
+
+  ~single_threaded_blas()
+  {
+    restore();
+  };
+
+  // restore the settings from before the object was created
+  void restore()
+  {
+    if (_restored){
+      return;
+    }
+    if (_mkl_threads > 0){
+      MKL_Set_Num_Threads(_mkl_threads);
+    }
+    if (_openblas_threads > 0){
+      openblas_set_num_threads(_openblas_threads);
+    }
+    omp_set_max_active_levels(_max_active_levels);
+    _restored = true;
+  };
+};
+
+#endif //_blas_threads_hpp_
@@ -8,10 +8,14 @@ Stores all relevant information for a carbon nanotube
 #include <armadillo>
 #include <complex>
 #include <stdexcept>
+#include <limits>
 
 #include "constants.h"
 #include "cnt.h"
 #include "progress.hpp"
+#include "partial_eig_sym.hpp"
+#include "lanczos.hpp"
+#include "blas_threads.hpp"
 
 void cnt::get_parameters()
 {
@@ -516,20 +520,9 @@ void cnt::find_relev_ik_range(double delta_energy, const cnt::el_energy_struct&
 
 }
 
-// fourier transformation of the coulomb interaction a.k.a v(q)
-cnt::vq_struct cnt::calculate_vq(const std::array<int,2> iq_range, const std::array<int,2> mu_range, unsigned int no_of_cnt_unit_cells)
+// q-independent part of the Ohno potential for all relative positions between atoms in a cnt with a given number of unit cells
+cnt::ohno_weights_struct cnt::calculate_ohno_weights(const unsigned int no_of_cnt_unit_cells) const
 {
-  // primary checks for function input
-  int nq = iq_range.at(1) - iq_range.at(0);
-  if (nq <= 0) {
-    throw "Incorrect range for iq!";
-  }
-  int n_mu = mu_range.at(1) - mu_range.at(0);
-  if (n_mu <= 0) {
-    throw "Incorrect range for mu_q!";
-  }
-  if (no_of_cnt_unit_cells % 2 == 0)  no_of_cnt_unit_cells ++;
-
   // calculate distances between atoms in a warped cnt unit cell.
 	arma::mat pos_aa = arma::mat(_Nu,2,arma::fill::zeros);
 	arma::mat pos_ab = arma::mat(_Nu,2,arma::fill::zeros);
@@ -553,51 +546,210 @@ cnt::vq_struct cnt::calculate_vq(const std::array<int,2> iq_range, const std::ar
       pos_bb(i,0) -= _ch_vec(0);
 	}
 
-  arma::cube rel_pos(_Nu*no_of_cnt_unit_cells,2,4,arma::fill::zeros);
-  for (int i=-std::floor(double(no_of_cnt_unit_cells)/2.); i<=std::floor(double(no_of_cnt_unit_cells)/2.); i++)
+  const std::array<const arma::mat*,4> pos = {&pos_aa, &pos_ab, &pos_ba, &pos_bb};
+  const double coeff = std::pow(4.*constants::pi*constants::eps0*_Upp/constants::q0/constants::q0,2);
+
+  ohno_weights_struct weights;
+  weights.n_cells = no_of_cnt_unit_cells;
+  weights.n_elem = _Nu*no_of_cnt_unit_cells;
+  for (int s=0; s<4; s++)
   {
-    int idx = (i+std::floor(double(no_of_cnt_unit_cells)/2.))*_Nu;
+    weights.x[s].resize(weights.n_elem);
+    weights.y[s].resize(weights.n_elem);
+    weights.w[s].resize(weights.n_elem);
+  }
+
+  const int half_length = std::floor(double(no_of_cnt_unit_cells)/2.);
+  for (int i=-half_length; i<=half_length; i++)
+  {
+    int idx = (i+half_length)*_Nu;
     for (int j=0; j<_Nu; j++)
     {
-      rel_pos.slice(0).row(idx+j) = pos_aa.row(j)+(i*_t_vec.t());
-      rel_pos.slice(1).row(idx+j) = pos_ab.row(j)+(i*_t_vec.t());
-      rel_pos.slice(2).row(idx+j) = pos_ba.row(j)+(i*_t_vec.t());
-      rel_pos.slice(3).row(idx+j) = pos_bb.row(j)+(i*_t_vec.t());
+      for (int s=0; s<4; s++)
+      {
+        const double x = (*pos[s])(j,0) + i*_t_vec(0);
+        const double y = (*pos[s])(j,1) + i*_t_vec(1);
+        weights.x[s][idx+j] = x;
+        weights.y[s][idx+j] = y;
+        weights.w[s][idx+j] = _Upp/std::sqrt(coeff*(std::pow(x,2)+std::pow(y,2))+1);
+      }
     }
   }
 
-  // calculate vq
-  arma::cx_cube vq(nq,n_mu,4,arma::fill::zeros);
-  arma::vec q_vec(nq,arma::fill::zeros);
+  return weights;
+}
 
-  arma::vec q(2,arma::fill::zeros);
-  const double coeff = std::pow(4.*constants::pi*constants::eps0*_Upp/constants::q0/constants::q0,2);
-  const std::complex<double> i1(0.,1.);
-  auto Uhno = [&](const arma::mat& R){
-    return std::exp(i1*arma::dot(q,R))*_Upp/std::sqrt(coeff*(std::pow(R(0),2)+std::pow(R(1),2))+1);
+// fourier transformation of the coulomb interaction a.k.a v(q)
+cnt::vq_struct cnt::calculate_vq(const std::array<int,2> iq_range, const std::array<int,2> mu_range, unsigned int no_of_cnt_unit_cells, \
+                                 const std::shared_ptr<const q_index_struct>& sparse_points)
+{
+  // primary checks for function input
+  int nq = iq_range.at(1) - iq_range.at(0);
+  if (nq <= 0) {
+    throw "Incorrect range for iq!";
+  }
+  int n_mu = mu_range.at(1) - mu_range.at(0);
+  if (n_mu <= 0) {
+    throw "Incorrect range for mu_q!";
+  }
+  if (no_of_cnt_unit_cells % 2 == 0)  no_of_cnt_unit_cells ++;
+
+  // q-independent part of the Ohno potential for all relative positions
+  const ohno_weights_struct weights = calculate_ohno_weights(no_of_cnt_unit_cells);
+
+  // with symmetric ranges only the iq>=0 half is calculated and the rest follows from vq(-q,-mu) = conj(vq(q,mu))
+  const bool symmetric = _use_q_symmetry and is_symmetric(iq_range) and is_symmetric(mu_range) and (not sparse_points);
+  const std::array<int,2> iq_stored_range = symmetric ? std::array<int,2>{0,iq_range[1]} : iq_range;
+  const int nq_stored = iq_stored_range[1] - iq_stored_range[0];
+
+  // elements of the (iq,mu) grid or of the sparse set of points that are calculated
+  const int n_elem = sparse_points ? sparse_points->size() : nq_stored*n_mu;
+  auto get_element = [&](const int& i_elem, int& iq, int& mu, int& row, int& col){
+    if (sparse_points){
+      iq = sparse_points->points[i_elem][0];
+      mu = sparse_points->points[i_elem][1];
+      row = i_elem;
+      col = 0;
+    } else {
+      row = i_elem / n_mu;
+      col = i_elem % n_mu;
+      iq = row + iq_stored_range[0];
+      mu = col + mu_range[0];
+    }
   };
 
-  progress_bar prog(nq, "vq");
+  // calculate vq
+  arma::cx_cube vq(sparse_points ? n_elem : nq_stored, sparse_points ? 1 : n_mu, 4, arma::fill::zeros);
+  arma::vec q_vec(vq.n_rows,arma::fill::zeros);
 
-  for (int iq=iq_range[0]; iq<iq_range[1]; iq++)
+  for (int i_elem=0; i_elem<n_elem; i_elem++)
   {
-    int iq_idx = iq-iq_range[0];
+    int iq, mu, row, col;
+    get_element(i_elem, iq, mu, row, col);
+    q_vec(row) = iq*arma::norm(_dk_l,2);
+  }
 
-    prog.step();
+  // in fft mode the sum over the cnt unit cell images is done for all iq at once. the phase of the image in cnt unit \
+     cell i is exp(i*iq*dk_l.t_vec*i) with dk_l.t_vec = 2pi/_nk_K1 and mu*K1.t_vec = 0, so folding the weights of \
+     the images modulo _nk_K1 and transforming them along the cnt axis gives the image sum for every iq. the result is \
+     stored as cell_sum(slice)(iq mod _nk_K1, atom) and only the sum over atoms of one cnt unit cell is left per (iq,mu).
+  const int nk_K1 = _nk_K1;
+  arma::field<arma::cx_mat> cell_sum(4);
+  if (_vq_method == vq_fft)
+  {
+    const int half_length = weights.n_cells/2;
+    for (int s=0; s<4; s++)
+    {
+      arma::cx_mat folded_weights(nk_K1, _Nu, arma::fill::zeros);
+      for (int i=-half_length; i<=half_length; i++)
+      {
+        const int i_folded = ((i % nk_K1) + nk_K1) % nk_K1;
+        for (int j=0; j<_Nu; j++)
+        {
+          folded_weights(i_folded,j) += weights.w[s][(i+half_length)*_Nu+j];
+        }
+      }
+      // arma::ifft uses exp(+i...) kernel with 1/N normalization
+      cell_sum(s) = double(nk_K1)*arma::ifft(folded_weights);
+    }
+  }
 
-    q_vec(iq_idx) = iq*arma::norm(_dk_l,2);
-    for (int mu=mu_range[0]; mu<mu_range[1]; mu++)
+  const int n_per_step = sparse_points ? std::max(1,n_elem/100) : n_mu; // number of elements per step of the progress bar
+  progress_bar prog(n_elem/n_per_step, "vq");
+  int n_done = 0; // number of elements that are calculated so far, used to update the progress bar
+
+  // the elements are split between threads. each element is accumulated by a single thread in a thread-private
+  // accumulator in the same order as the serial loop, therefore the result does not depend on the number of threads.
+  const int reseed_interval = 64; // number of cnt unit cells between exact phase calculations in the direct sum
+  #pragma omp parallel
+  {
+    // phases exp(i*q.r) of the atoms of the current cnt unit cell in the direct sum, allocated once per thread
+    std::vector<double> phase_re(_Nu), phase_im(_Nu);
+
+    #pragma omp for schedule(dynamic)
+    for (int i_elem=0; i_elem<n_elem; i_elem++)
     {
-      int mu_idx = mu - mu_range[0];
-      q = iq*_dk_l + mu*_K1;
-      // std::cout << "after addition!\n";
-      for (int i=0; i<4; i++)
+      int iq, mu, row, col;
+      get_element(i_elem, iq, mu, row, col);
+      const double qx = iq*_dk_l(0) + mu*_K1(0);
+      const double qy = iq*_dk_l(1) + mu*_K1(1);
+
+      std::array<std::complex<double>,4> vq_local = {0., 0., 0., 0.};
+
+      // sum over atoms of the central cnt unit cell using the transformed image sums
+      if (_vq_method == vq_fft)
       {
-        for (unsigned int k=0; k<_Nu*no_of_cnt_unit_cells; k++)
+        const int iq_folded = ((iq % nk_K1) + nk_K1) % nk_K1;
+        const int center_idx = (weights.n_cells/2)*_Nu;
+        for (int i=0; i<4; i++)
         {
-          vq(iq_idx,mu_idx,i) += Uhno(rel_pos.slice(i).row(k));
+          for (int j=0; j<_Nu; j++)
+          {
+            const double phase = qx*weights.x[i][center_idx+j] + qy*weights.y[i][center_idx+j];
+            vq_local[i] += std::complex<double>(std::cos(phase),std::sin(phase))*cell_sum(i)(iq_folded,j);
+          }
         }
       }
+      else
+      {
+        // weighted phase sum over the precomputed Ohno weights. the atoms of each cnt unit cell are those of the previous \
+           cell shifted by t_vec, so their phases follow from the previous cell by a multiplication with exp(i*q.t_vec) and \
+           the inner loops are plain multiply-adds. the phases are recalculated with cos and sin every reseed_interval cells \
+           to keep the rounding error of the recurrence small.
+        const double step_re = std::cos(qx*_t_vec(0) + qy*_t_vec(1));
+        const double step_im = std::sin(qx*_t_vec(0) + qy*_t_vec(1));
+        for (int i=0; i<4; i++)
+        {
+          const double* x = weights.x[i].data();
+          const double* y = weights.y[i].data();
+          const double* w = weights.w[i].data();
+          double re = 0, im = 0;
+          for (int c=0; c<weights.n_cells; c++)
+          {
+            const int offset = c*_Nu;
+            if (c % reseed_interval == 0)
+            {
+              for (int j=0; j<_Nu; j++)
+              {
+                const double phase = qx*x[offset+j] + qy*y[offset+j];
+                phase_re[j] = std::cos(phase);
+                phase_im[j] = std::sin(phase);
+              }
+            }
+            else
+            {
+              #pragma omp simd
+              for (int j=0; j<_Nu; j++)
+              {
+                const double next_re = phase_re[j]*step_re - phase_im[j]*step_im;
+                phase_im[j] = phase_re[j]*step_im + phase_im[j]*step_re;
+                phase_re[j] = next_re;
+              }
+            }
+            #pragma omp simd reduction(+:re,im)
+            for (int j=0; j<_Nu; j++)
+            {
+              re += w[offset+j]*phase_re[j];
+              im += w[offset+j]*phase_im[j];
+            }
+          }
+          vq_local[i] = std::complex<double>(re,im);
+        }
+      }
+
+      for (int i=0; i<4; i++)
+      {
+        vq(row,col,i) = vq_local[i];
+      }
+
+      int n_done_local;
+      #pragma omp atomic capture
+      n_done_local = ++n_done;
+      if (n_done_local % n_per_step == 0)
+      {
+        #pragma omp critical (vq_progress)
+        prog.step();
+      }
     }
   }
 
@@ -626,12 +778,15 @@ cnt::vq_struct cnt::calculate_vq(const std::array<int,2> iq_range, const std::ar
   vq_s.mu_range = mu_range;
   vq_s.nq = nq;
   vq_s.n_mu = n_mu;
+  vq_s.symmetric = symmetric;
+  vq_s.sparse_points = sparse_points;
 
   return vq_s;
 }
 
 // polarization of electronic states a.k.a PI(q)
-cnt::PI_struct cnt::calculate_polarization(const std::array<int,2> iq_range, const std::array<int,2> mu_range, const cnt::el_energy_struct& elec_struct)
+cnt::PI_struct cnt::calculate_polarization(const std::array<int,2> iq_range, const std::array<int,2> mu_range, const cnt::el_energy_struct& elec_struct, \
+                                           const std::shared_ptr<const q_index_struct>& sparse_points)
 {
   // primary checks for function input
   int nq = iq_range.at(1) - iq_range.at(0);
@@ -643,68 +798,128 @@ cnt::PI_struct cnt::calculate_polarization(const std::array<int,2> iq_range, con
     throw "Incorrect range for mu_q in calculate_polarization!";
   }
 
-  int ikq, mu_kq;
-  int ik, mu_k;
-  int iq, mu_q;
-  // lambda function to wrap iq+ik and mu_k+mu_q inside the K2-extended brillouine zone
-  auto get_kq = [&](){
-    mu_kq = mu_k+mu_q;
-    ikq = ik+iq;
-    while (mu_kq >= elec_struct.mu_range[1]) {
-      mu_kq -= elec_struct.n_mu;
-      ikq += _nk_K1*_M;
-    }
-    while (mu_kq < elec_struct.mu_range[0]) {
-      mu_kq += elec_struct.n_mu;
-      ikq -= _nk_K1*_M;
-    }
-    while (ikq >= elec_struct.ik_range[1]){
-      ikq -= elec_struct.nk;
-    }
-    while (ikq < elec_struct.ik_range[0]){
-      ikq += elec_struct.nk;
+  // with symmetric ranges only the iq>=0 half is calculated and the rest follows from PI(-q,-mu) = PI(q,mu)
+  const bool symmetric = _use_q_symmetry and is_symmetric(iq_range) and is_symmetric(mu_range) and (not sparse_points);
+  const std::array<int,2> iq_stored_range = symmetric ? std::array<int,2>{0,iq_range[1]} : iq_range;
+  const int nq_stored = iq_stored_range[1] - iq_stored_range[0];
+
+  // elements of the (iq,mu_q) grid or of the sparse set of points that are calculated
+  const int n_elem = sparse_points ? sparse_points->size() : nq_stored*n_mu;
+  auto get_element = [&](const int& i_elem, int& iq, int& mu_q, int& row, int& col){
+    if (sparse_points){
+      iq = sparse_points->points[i_elem][0];
+      mu_q = sparse_points->points[i_elem][1];
+      row = i_elem;
+      col = 0;
+    } else {
+      row = i_elem / n_mu;
+      col = i_elem % n_mu;
+      iq = row + iq_stored_range[0];
+      mu_q = col + mu_range[0];
     }
   };
 
-  arma::mat PI(nq,n_mu,arma::fill::zeros);
-  arma::vec q_vec(nq,arma::fill::zeros);
+  const int nk = elec_struct.nk;
+  const int n_mu_k = elec_struct.n_mu;
+
+  // wrapped index maps for mu_k+mu_q in the format (mu_k_idx + n_mu_k*mu_q_idx): index of mu_kq inside the \
+     K2-extended brillouine zone and the shift in ik that comes with wrapping mu_kq
+  std::vector<int> mu_kq_idx_map(n_mu_k*n_mu), ik_shift_map(n_mu_k*n_mu);
+  for (int mu_q=mu_range[0]; mu_q<mu_range[1]; mu_q++)
+  {
+    for (int mu_k=elec_struct.mu_range[0]; mu_k<elec_struct.mu_range[1]; mu_k++)
+    {
+      int mu_kq = mu_k+mu_q;
+      int ik_shift = 0;
+      while (mu_kq >= elec_struct.mu_range[1]) {
+        mu_kq -= n_mu_k;
+        ik_shift += _nk_K1*_M;
+      }
+      while (mu_kq < elec_struct.mu_range[0]) {
+        mu_kq += n_mu_k;
+        ik_shift -= _nk_K1*_M;
+      }
+      const int map_idx = (mu_k-elec_struct.mu_range[0]) + n_mu_k*(mu_q-mu_range[0]);
+      mu_kq_idx_map[map_idx] = mu_kq - elec_struct.mu_range[0];
+      ik_shift_map[map_idx] = ik_shift;
+    }
+  }
+
+  // raw pointers to the wavefunctions of each cutting line with elements in the order of (iA + 2*i_band + 4*ik_idx) \
+     and to the energies with elements in the order of (i_band + 2*ik_idx + 2*nk*mu_idx)
+  std::vector<const std::complex<double>*> psi(n_mu_k);
+  for (int mu_k_idx=0; mu_k_idx<n_mu_k; mu_k_idx++)
+  {
+    psi[mu_k_idx] = elec_struct.wavefunc(mu_k_idx).memptr();
+  }
+  const double* energy = elec_struct.energy.memptr();
+
+  arma::mat PI(sparse_points ? n_elem : nq_stored, sparse_points ? 1 : n_mu, arma::fill::zeros);
+  arma::vec q_vec(PI.n_rows,arma::fill::zeros);
+  for (int i_elem=0; i_elem<n_elem; i_elem++)
+  {
+    int iq, mu_q, row, col;
+    get_element(i_elem, iq, mu_q, row, col);
+    q_vec(row) = iq*arma::norm(_dk_l);
+  }
 
   const int iv = 0;
   const int ic = 1;
 
-  progress_bar prog(nq, "calculate polarization");
+  const int n_per_step = sparse_points ? std::max(1,n_elem/100) : n_mu; // number of elements per step of the progress bar
+  progress_bar prog(n_elem/n_per_step, "calculate polarization");
+  int n_done = 0; // number of elements that are calculated so far, used to update the progress bar
 
-  int iq_idx, mu_q_idx;
-  int ik_idx, mu_k_idx;
-  int i_kq_idx, mu_kq_idx;
-  for (iq=iq_range[0]; iq<iq_range[1]; iq++)
+  #pragma omp parallel
   {
-    iq_idx = iq - iq_range[0];
-    q_vec(iq_idx) = iq*arma::norm(_dk_l);
-
-    prog.step(iq_idx);
+    // shift of ik_idx to get ikq_idx for each mu_k, wrapped inside [0,nk). allocated once per thread and refilled for \
+       each element.
+    std::vector<int> ikq_shift(n_mu_k);
 
-    for (mu_q=mu_range[0]; mu_q<mu_range[1]; mu_q++)
+    #pragma omp for schedule(dynamic)
+    for (int i_elem=0; i_elem<n_elem; i_elem++)
     {
-      mu_q_idx = mu_q - mu_range[0];
-      for (ik=elec_struct.ik_range[0]; ik<elec_struct.ik_range[1]; ik++)
+      int iq, mu_q, row, col;
+      get_element(i_elem, iq, mu_q, row, col);
+      const int mu_q_idx = mu_q - mu_range[0];
+      const int* mu_kq_idx = &mu_kq_idx_map[n_mu_k*mu_q_idx];
+
+      for (int mu_k_idx=0; mu_k_idx<n_mu_k; mu_k_idx++)
+      {
+        ikq_shift[mu_k_idx] = (iq + ik_shift_map[mu_k_idx + n_mu_k*mu_q_idx]) % nk;
+        if (ikq_shift[mu_k_idx] < 0) ikq_shift[mu_k_idx] += nk;
+      }
+
+      double PI_local = 0;
+      for (int ik_idx=0; ik_idx<nk; ik_idx++)
       {
-        ik_idx = ik - elec_struct.ik_range[0];
-        for (mu_k=elec_struct.mu_range[0]; mu_k<elec_struct.mu_range[1]; mu_k++)
+        for (int mu_k_idx=0; mu_k_idx<n_mu_k; mu_k_idx++)
         {
-          mu_k_idx = mu_k - elec_struct.mu_range[0];
-          get_kq();
-          mu_kq_idx = mu_kq - elec_struct.mu_range[0];
-          i_kq_idx = ikq - elec_struct.ik_range[0];
-
-          PI(iq_idx,mu_q_idx) += std::pow(std::abs(arma::dot(arma::conj(elec_struct.wavefunc(mu_k_idx).slice(ik_idx).col(iv)),\
-                                                             elec_struct.wavefunc(mu_kq_idx).slice(i_kq_idx).col(ic))),2)/ \
-                                          (elec_struct.energy(ic,i_kq_idx,mu_kq_idx)-elec_struct.energy(iv,ik_idx,mu_k_idx)) + \
-                                 std::pow(std::abs(arma::dot(arma::conj(elec_struct.wavefunc(mu_k_idx).slice(ik_idx).col(ic)), \
-                                                             elec_struct.wavefunc(mu_kq_idx).slice(i_kq_idx).col(iv))),2)/ \
-                                          (elec_struct.energy(ic,ik_idx,mu_k_idx)-elec_struct.energy(iv,i_kq_idx,mu_kq_idx));
+          int ikq_idx = ik_idx + ikq_shift[mu_k_idx];
+          if (ikq_idx >= nk) ikq_idx -= nk;
+
+          const std::complex<double>* psi_k = psi[mu_k_idx] + 4*ik_idx;
+          const std::complex<double>* psi_kq = psi[mu_kq_idx[mu_k_idx]] + 4*ikq_idx;
+          const double* energy_k = energy + 2*(ik_idx + nk*mu_k_idx);
+          const double* energy_kq = energy + 2*(ikq_idx + nk*mu_kq_idx[mu_k_idx]);
+
+          // spinor overlaps <v,k|c,k+q> and <c,k|v,k+q>
+          const std::complex<double> overlap_vc = std::conj(psi_k[2*iv])*psi_kq[2*ic] + std::conj(psi_k[1+2*iv])*psi_kq[1+2*ic];
+          const std::complex<double> overlap_cv = std::conj(psi_k[2*ic])*psi_kq[2*iv] + std::conj(psi_k[1+2*ic])*psi_kq[1+2*iv];
+
+          PI_local += std::norm(overlap_vc)/(energy_kq[ic]-energy_k[iv]) + std::norm(overlap_cv)/(energy_k[ic]-energy_kq[iv]);
         }
       }
+      PI(row,col) = PI_local;
+
+      int n_done_local;
+      #pragma omp atomic capture
+      n_done_local = ++n_done;
+      if (n_done_local % n_per_step == 0)
+      {
+        #pragma omp critical (PI_progress)
+        prog.step();
+      }
     }
   }
 
@@ -727,12 +942,15 @@ cnt::PI_struct cnt::calculate_polarization(const std::array<int,2> iq_range, con
   PI_s.mu_range = mu_range;
   PI_s.nq = nq;
   PI_s.n_mu = n_mu;
+  PI_s.symmetric = symmetric;
+  PI_s.sparse_points = sparse_points;
 
   return PI_s;
 }
 
 // dielectric function a.k.a eps(q)
-cnt::epsilon_struct cnt::calculate_dielectric(const std::array<int,2> iq_range, const std::array<int,2> mu_range)
+cnt::epsilon_struct cnt::calculate_dielectric(const std::array<int,2> iq_range, const std::array<int,2> mu_range, \
+                                              const std::shared_ptr<const q_index_struct>& sparse_points)
 {
   // check if vq has been calculated properly before
   if (not (in_range(iq_range,_vq.iq_range) and in_range(mu_range,_vq.mu_range))){
@@ -745,20 +963,46 @@ cnt::epsilon_struct cnt::calculate_dielectric(const std::array<int,2> iq_range,
                             trying to calculate dielectric function");
   }
 
+  // dielectric function for a single (iq,mu) point
+  auto get_eps = [&](const int& iq, const int& mu){
+    double vq_mean = 0;
+    for (int i_pair=0; i_pair<4; i_pair++)
+    {
+      vq_mean += std::real(_vq(iq,mu,i_pair))/4.;
+    }
+    return 1. + vq_mean*_PI(iq,mu);
+  };
+
   int nq = iq_range[1] - iq_range[0];
   int n_mu = mu_range[1] - mu_range[0];
-  arma::mat eps = arma::real(arma::mean(_vq.data,2));
-  eps = eps.submat(iq_range[0]-_vq.iq_range[0],mu_range[0]-_vq.mu_range[0],arma::size(nq,n_mu));
-  eps %= _PI.data.submat(iq_range[0]-_PI.iq_range[0],mu_range[0]-_PI.mu_range[0],arma::size(nq,n_mu));
-  std::cout << "size of dielectric function matrix: " << arma::size(eps) << std::endl;
-  eps += 1.;
-
-  arma::vec q_vec(nq);
-  for (int iq=iq_range[0]; iq<iq_range[1]; iq++)
+  arma::mat eps;
+  arma::vec q_vec;
+  if (sparse_points)
   {
-    int iq_idx = iq - iq_range[0];
-    q_vec(iq_idx) = iq*arma::norm(_dk_l);
+    eps.zeros(sparse_points->size(),1);
+    q_vec.zeros(sparse_points->size());
+    for (int i_point=0; i_point<sparse_points->size(); i_point++)
+    {
+      const int iq = sparse_points->points[i_point][0];
+      const int mu = sparse_points->points[i_point][1];
+      eps(i_point,0) = get_eps(iq,mu);
+      q_vec(i_point) = iq*arma::norm(_dk_l);
+    }
+  }
+  else
+  {
+    eps.zeros(nq,n_mu);
+    q_vec.zeros(nq);
+    for (int iq=iq_range[0]; iq<iq_range[1]; iq++)
+    {
+      for (int mu=mu_range[0]; mu<mu_range[1]; mu++)
+      {
+        eps(iq-iq_range[0],mu-mu_range[0]) = get_eps(iq,mu);
+      }
+      q_vec(iq-iq_range[0]) = iq*arma::norm(_dk_l);
+    }
   }
+  std::cout << "size of dielectric function matrix: " << arma::size(eps) << std::endl;
 
   std::cout << "\n...calculated dielectric function: epsilon(q)\n";
 
@@ -776,72 +1020,150 @@ cnt::epsilon_struct cnt::calculate_dielectric(const std::array<int,2> iq_range,
   eps_s.mu_range = mu_range;
   eps_s.nq = nq;
   eps_s.n_mu = n_mu;
+  eps_s.sparse_points = sparse_points;
   return eps_s;
 }
 
-// calculate exciton dispersion
-std::vector<cnt::exciton_struct> cnt::calculate_A_excitons(const std::array<int,2> ik_cm_range, const cnt::el_energy_struct& elec_struct)
+// find the set of (iq,mu) momentum transfers that are used in the exciton kernel by calculate_A_excitons
+std::shared_ptr<const cnt::q_index_struct> cnt::find_relevant_q_transfers(const std::array<int,2> ik_cm_range, const cnt::el_energy_struct& elec_struct) const
 {
-  // some utility variables that are going to be used over and over again
-  int ik_c, mu_c;
-  int ik_v, mu_v;
-  int ik_cp, mu_cp;
-  int ik_vp, mu_vp;
-  int ik_c_diff, mu_c_diff;
-  int ik_cm, mu_cm;
-
-  std::complex<double> dir_interaction;
-  std::complex<double> xch_interaction;
-
-  const int iv = 0;
-  const int ic = 1;
-
   const int i_valley_1 = 0;
   const int i_valley_2 = 1;
+  const int nk_relev = int(_relev_ik_range[0].size());
 
-  // lambda function to calculate direct interaction
-  auto get_direct_interaction = [&](){
-    ik_c_diff = ik_c-ik_cp;
-    mu_c_diff = mu_c-mu_cp;
-    while(ik_c_diff < elec_struct.ik_range[0]){
-      ik_c_diff += elec_struct.nk;
+  // wrap ik inside the K2-extended zone in the same way as calculate_A_excitons
+  auto wrap_ik = [&elec_struct](int ik){
+    while (ik >= elec_struct.ik_range[1]){
+      ik -= elec_struct.nk;
+    }
+    while (ik < elec_struct.ik_range[0]){
+      ik += elec_struct.nk;
     }
-    while(ik_c_diff >= elec_struct.ik_range[1]){
-      ik_c_diff -= elec_struct.nk;
+    return ik;
+  };
+
+  auto q_points = std::make_shared<q_index_struct>();
+
+  // direct interaction between valley_1 and valley_1 does not depend on ik_cm
+  for (int ik_c_idx=0; ik_c_idx<nk_relev; ik_c_idx++)
+  {
+    const int ik_c = _relev_ik_range[i_valley_1][ik_c_idx][0];
+    const int mu_c = _relev_ik_range[i_valley_1][ik_c_idx][1];
+    for (int ik_cp_idx=0; ik_cp_idx<=ik_c_idx; ik_cp_idx++)
+    {
+      const int ik_cp = _relev_ik_range[i_valley_1][ik_cp_idx][0];
+      const int mu_cp = _relev_ik_range[i_valley_1][ik_cp_idx][1];
+      q_points->insert(wrap_ik(ik_c-ik_cp), mu_c-mu_cp);
     }
+  }
+
+  for (int ik_cm=ik_cm_range[0]; ik_cm<ik_cm_range[1]; ik_cm++)
+  {
+    // exchange interaction
+    const int mu_cm = 0;
+    q_points->insert(ik_cm, mu_cm);
 
-    dir_interaction = 0;
-    for (int i=0; i<2; i++)
+    // direct interaction between valley_1 and valley_2
+    for (int ik_c_idx=0; ik_c_idx<nk_relev; ik_c_idx++)
     {
-      for (int j=0; j<2; j++)
+      const int ik_c = _relev_ik_range[i_valley_1][ik_c_idx][0];
+      const int mu_c = _relev_ik_range[i_valley_1][ik_c_idx][1];
+      for (int ik_vp_idx=ik_c_idx; ik_vp_idx<nk_relev; ik_vp_idx++)
       {
-        dir_interaction += std::conj(elec_struct.wavefunc(mu_c -elec_struct.mu_range[0])(i,ic,ik_c -elec_struct.ik_range[0]))* \
-                                     elec_struct.wavefunc(mu_v -elec_struct.mu_range[0])(j,iv,ik_v -elec_struct.ik_range[0]) * \
-                                     elec_struct.wavefunc(mu_cp-elec_struct.mu_range[0])(i,ic,ik_cp-elec_struct.ik_range[0]) * \
-                           std::conj(elec_struct.wavefunc(mu_vp-elec_struct.mu_range[0])(j,iv,ik_vp-elec_struct.ik_range[0]))* \
-                                                          _vq.data(ik_c_diff-_vq.iq_range[0],mu_c_diff-_vq.mu_range[0],2*i+j)/ \
-                                                             _eps.data(ik_c_diff-_eps.iq_range[0],mu_c_diff-_eps.mu_range[0]);
+        const int ik_cp = wrap_ik(_relev_ik_range[i_valley_2][ik_vp_idx][0]+ik_cm);
+        const int mu_cp = _relev_ik_range[i_valley_2][ik_vp_idx][1];
+        q_points->insert(wrap_ik(ik_c-ik_cp), mu_c-mu_cp);
       }
     }
-    return dir_interaction;
+  }
+
+  std::cout << "\n...found relevant momentum transfers for the exciton kernel\n";
+  std::cout << "number of (iq,mu) points: " << q_points->size() << "\n";
+
+  std::cout << "saved relevant (iq,mu) points\n";
+  arma::imat points(q_points->size(),2);
+  for (int i_point=0; i_point<q_points->size(); i_point++)
+  {
+    points(i_point,0) = q_points->points[i_point][0];
+    points(i_point,1) = q_points->points[i_point][1];
+  }
+  std::string filename = _directory.path()/"q_points.dat";
+  points.save(filename, arma::arma_ascii);
+
+  return q_points;
+}
+
+// screened interaction vq/eps for all momentum transfers between the relevant states used in the exciton kernel
+cnt::screened_interaction_struct cnt::calculate_screened_interaction(const cnt::el_energy_struct& elec_struct) const
+{
+  screened_interaction_struct W;
+  W.nk = elec_struct.nk;
+
+  // range of mu differences between the relevant states of both valleys
+  int mu_min = std::numeric_limits<int>::max();
+  int mu_max = std::numeric_limits<int>::min();
+  for (const auto& valley: _relev_ik_range)
+  {
+    for (const auto& state: valley)
+    {
+      mu_min = std::min(mu_min, state[1]);
+      mu_max = std::max(mu_max, state[1]);
+    }
+  }
+  W.mu_range = {mu_min-mu_max, mu_max-mu_min+1};
+  W.n_mu = W.mu_range[1] - W.mu_range[0];
+
+  // wrap the difference of ik values inside the K2-extended zone in the same way as the exciton kernel
+  W.iq_idx.resize(2*W.nk-1);
+  for (int dik=-(W.nk-1); dik<W.nk; dik++)
+  {
+    int iq = dik;
+    while (iq >= elec_struct.ik_range[1]){
+      iq -= elec_struct.nk;
+    }
+    while (iq < elec_struct.ik_range[0]){
+      iq += elec_struct.nk;
+    }
+    W.iq_idx[dik+W.nk-1] = iq-elec_struct.ik_range[0];
+  }
+
+  // only (iq,mu) points that are calculated in eps are filled, the rest are never used by the exciton kernel
+  auto is_calculated = [&](const int& iq, const int& mu){
+    if (_eps.sparse_points){
+      return _eps.sparse_points->index.count(q_index_struct::key(iq,mu)) > 0;
+    }
+    return in_range(iq,_eps.iq_range) and in_range(mu,_eps.mu_range);
   };
 
-  // lambda function to calculate exchange interaction
-  auto get_exchange_interaction = [&](){
-    xch_interaction = 0;
-    for (int i=0; i<2; i++)
+  W.data.assign(4*W.nk*W.n_mu, std::complex<double>(0,0));
+  for (int iq_idx=0; iq_idx<W.nk; iq_idx++)
+  {
+    const int iq = iq_idx + elec_struct.ik_range[0];
+    for (int mu=W.mu_range[0]; mu<W.mu_range[1]; mu++)
     {
-      for (int j=0; j<2; j++)
+      if (not is_calculated(iq,mu)) continue;
+      const double eps = _eps(iq,mu);
+      for (int i_pair=0; i_pair<4; i_pair++)
       {
-        xch_interaction += std::conj(elec_struct.wavefunc(mu_c -elec_struct.mu_range[0])(i,ic,ik_c -elec_struct.ik_range[0]))* \
-                                     elec_struct.wavefunc(mu_v -elec_struct.mu_range[0])(i,iv,ik_v -elec_struct.ik_range[0]) * \
-                                     elec_struct.wavefunc(mu_cp-elec_struct.mu_range[0])(j,ic,ik_cp-elec_struct.ik_range[0]) * \
-                           std::conj(elec_struct.wavefunc(mu_vp-elec_struct.mu_range[0])(j,iv,ik_vp-elec_struct.ik_range[0]))* \
-                                                                  _vq.data(ik_cm-_vq.iq_range[0],mu_cm-_vq.mu_range[0],2*i+j);
+        W.data[4*(iq_idx*W.n_mu+mu-W.mu_range[0])+i_pair] = _vq(iq,mu,i_pair)/eps;
       }
     }
-    return xch_interaction;
-  };
+  }
+
+  std::cout << "\n...calculated screened interaction: W(q) = vq/eps\n";
+  std::cout << "size of screened interaction table: (" << W.nk << ", " << W.n_mu << ", 4)\n";
+
+  return W;
+}
+
+// calculate exciton dispersion
+std::vector<cnt::exciton_struct> cnt::calculate_A_excitons(const std::array<int,2> ik_cm_range, const cnt::el_energy_struct& elec_struct)
+{
+  const int iv = 0;
+  const int ic = 1;
+
+  const int i_valley_1 = 0;
+  const int i_valley_2 = 1;
 
   // get ik of valence band state by taking care of wrapping around K2-extended zone
   auto get_ikv = [&elec_struct](const int& ik_c, const int& ik_cm){
@@ -872,132 +1194,393 @@ std::vector<cnt::exciton_struct> cnt::calculate_A_excitons(const std::array<int,
   int nk_relev = int(_relev_ik_range[0].size());
   int nk_c = 2*nk_relev;
 
-  arma::mat ex_energy_A1(nk_cm,nk_relev,arma::fill::zeros);
-  arma::mat ex_energy_A2_singlet(nk_cm,nk_relev,arma::fill::zeros);
-  arma::mat ex_energy_A2_triplet(nk_cm,nk_relev,arma::fill::zeros);
+  // when only part of the spectrum is requested the exciton matrices are sized to the requested number of states and \
+     the states that are not found (because of the energy cutoff) are marked with infinite energy and zero wavefunction
+  const bool partial_spectrum = (_n_exciton_states > 0) or (_exciton_energy_cutoff < arma::datum::inf);
+  const int n_states = (_n_exciton_states > 0) ? std::min(_n_exciton_states,nk_relev) : nk_relev;
+  std::array<int,3> n_found_states = {0, 0, 0}; // maximum number of states found for A1, A2 triplet, and A2 singlet excitons
+
+  arma::mat ex_energy_A1(nk_cm,n_states,arma::fill::zeros);
+  arma::mat ex_energy_A2_singlet(nk_cm,n_states,arma::fill::zeros);
+  arma::mat ex_energy_A2_triplet(nk_cm,n_states,arma::fill::zeros);
+  if (partial_spectrum)
+  {
+    ex_energy_A1.fill(arma::datum::inf);
+    ex_energy_A2_singlet.fill(arma::datum::inf);
+    ex_energy_A2_triplet.fill(arma::datum::inf);
+  }
   
-  arma::cx_cube ex_psi_A1(nk_c,nk_relev,nk_cm, arma::fill::zeros);
-  arma::cx_cube ex_psi_A2_singlet(nk_c,nk_relev,nk_cm, arma::fill::zeros);
-  arma::cx_cube ex_psi_A2_triplet(nk_c,nk_relev,nk_cm, arma::fill::zeros);
+  arma::cx_cube ex_psi_A1(nk_c,n_states,nk_cm, arma::fill::zeros);
+  arma::cx_cube ex_psi_A2_singlet(nk_c,n_states,nk_cm, arma::fill::zeros);
+  arma::cx_cube ex_psi_A2_triplet(nk_c,n_states,nk_cm, arma::fill::zeros);
 
   arma::ucube ik_idx(4, nk_c, nk_cm);
 
-  arma::cx_mat kernel_11(nk_relev,nk_relev,arma::fill::zeros);
-  arma::cx_mat kernel_12(nk_relev,nk_relev,arma::fill::zeros);
-  arma::cx_mat kernel_exchange(nk_relev,nk_relev,arma::fill::zeros);
-  arma::vec energy;
-  arma::cx_mat psi;
   arma::vec k_cm_vec(nk_cm,arma::fill::zeros);
 
-  progress_bar prog(nk_cm, "calculate ex_energy");
+  // store the states of the exciton, the second half of the wavefunction (valley_2) gets the relative sign of the exciton type
+  auto store_states = [&](const arma::vec& energy, const arma::cx_mat& psi, const double valley_2_sign, const int ik_cm_idx, \
+                          arma::mat& ex_energy, arma::cx_cube& ex_psi, int& n_found){
+    const int n = energy.n_elem;
+    n_found = std::max(n_found, n);
+    if (n == 0) return;
+    ex_energy.row(ik_cm_idx).head(n) = energy.t();
+    ex_psi.slice(ik_cm_idx).submat(0,0,arma::size(nk_relev,n)) = (+1/std::sqrt(2.))*psi;
+    ex_psi.slice(ik_cm_idx).submat(nk_relev,0,arma::size(nk_relev,n)) = (valley_2_sign/std::sqrt(2.))*psi;
+  };
 
-  // loop to calculate exciton dispersion
-  for (ik_cm=ik_cm_range[0]; ik_cm<ik_cm_range[1]; ik_cm++)
+  // solve the eigen value problem of a dense kernel and store the states of the exciton
+  auto solve_kernel = [&](const arma::cx_mat& kernel, const double valley_2_sign, const int ik_cm_idx, \
+                          arma::mat& ex_energy, arma::cx_cube& ex_psi, int& n_found){
+    arma::vec energy;
+    arma::cx_mat psi;
+    if (partial_spectrum){
+      partial_eig_sym(energy, psi, kernel, _n_exciton_states, _exciton_energy_cutoff);
+    } else {
+      arma::eig_sym(energy, psi, kernel);
+    }
+    store_states(energy, psi, valley_2_sign, ik_cm_idx, ex_energy, ex_psi, n_found);
+  };
+
+  // the matrix-free solver relies on the relevant states of each valley being on a single cutting line with consecutive ik \
+     values, so that the direct interaction only depends on the difference of state indices
+  if (_exciton_solver == exciton_lanczos)
   {
-    kernel_11.zeros();
-    kernel_12.zeros();
-    kernel_exchange.zeros();
-    mu_cm = 0;
-    int ik_cm_idx = ik_cm - ik_cm_range[0];
-    k_cm_vec(ik_cm_idx) = ik_cm*arma::norm(_dk_l);
+    for (const auto& valley: _relev_ik_range)
+    {
+      for (int i=1; i<nk_relev; i++)
+      {
+        if ((valley[i][1] != valley[0][1]) or ((valley[i][0]-valley[i-1][0]-1) % elec_struct.nk != 0)){
+          throw std::logic_error("lanczos exciton solver needs relevant states with consecutive ik on a single cutting line");
+        }
+      }
+    }
+  }
+
+  // number of points of the circular convolutions in the matrix-free solver, large enough to hold all ik differences
+  int n_fft = 1;
+  while (n_fft < 2*nk_relev-1){
+    n_fft *= 2;
+  }
 
-    prog.step(ik_cm_idx);
+  progress_bar prog(nk_cm, "calculate ex_energy");
 
+  // screened interaction of the direct term does not depend on the center of mass momentum
+  const screened_interaction_struct W = calculate_screened_interaction(elec_struct);
 
-    for (int ik_c_idx=0; ik_c_idx<nk_relev; ik_c_idx++)
+  // each thread builds its own kernel matrices and solves them for a subset of center of mass momenta. the eigen solvers \
+     run inside the parallel region, so BLAS/LAPACK is limited to a single thread until the region is finished.
+  single_threaded_blas blas_threads;
+  #pragma omp parallel
+  {
+    // dense kernel matrices are only needed by the dense solver
+    arma::cx_mat kernel_11, kernel_12, kernel_exchange;
+    if (_exciton_solver == exciton_dense)
     {
-      ik_c = _relev_ik_range[i_valley_1][ik_c_idx][0];
-      mu_c = _relev_ik_range[i_valley_1][ik_c_idx][1];
-      ik_v = get_ikv(ik_c,ik_cm);
-      mu_v = mu_c;
+      kernel_11.zeros(nk_relev,nk_relev);
+      kernel_12.zeros(nk_relev,nk_relev);
+      kernel_exchange.zeros(nk_relev,nk_relev);
+    }
+    std::array<int,3> n_found_local = {0, 0, 0};
 
-      kernel_11(ik_c_idx, ik_c_idx) += elec_struct.energy(ic,ik_c-elec_struct.ik_range[0],mu_c-elec_struct.mu_range[0]) - \
-                                       elec_struct.energy(iv,ik_v-elec_struct.ik_range[0],mu_c-elec_struct.mu_range[0]);
+    // per state tables of each valley for the current center of mass momentum: ik index and mu of the conduction band \
+       state and the spinor form factor conj(psi_c(i))*psi_v(j) stored at 4*state+2*i+j
+    std::array<std::vector<int>,2> state_ik_idx, state_mu;
+    std::array<std::vector<std::complex<double>>,2> state_ff;
+    for (int i_valley=0; i_valley<2; i_valley++)
+    {
+      state_ik_idx[i_valley].resize(nk_relev);
+      state_mu[i_valley].resize(nk_relev);
+      state_ff[i_valley].resize(4*nk_relev);
+    }
+    arma::cx_vec transition_energy(nk_relev); // energy difference of the conduction and valence band states of valley_1
+
+    // matrix-free solution of the exciton kernels for the current center of mass momentum using the per state tables. \
+       the direct terms only depend on the difference of state indices, so they are applied as fft convolutions where the \
+       triangular parts of the kernel are kept the same as in the dense assembly. the exchange term is applied through \
+       prefix sums over the states.
+    auto solve_lanczos = [&](const int ik_cm_idx, const std::array<std::complex<double>,4>& vq_cm){
+      const int n = nk_relev;
+
+      // form factors of the states in the format (state, atom_pair_index)
+      const arma::cx_mat F1 = arma::cx_mat(state_ff[i_valley_1].data(),4,n).st();
+      const arma::cx_mat F2 = arma::cx_mat(state_ff[i_valley_2].data(),4,n).st();
+
+      // difference of ik indices and mu values between the first states of valley_1 and valley_2
+      const int dik_12 = state_ik_idx[i_valley_1][0]-state_ik_idx[i_valley_2][0];
+      const int dmu_12 = state_mu[i_valley_1][0]-state_mu[i_valley_2][0];
+      auto wrap_dik = [&](int dik){
+        dik %= elec_struct.nk;
+        return (dik < 0) ? dik+elec_struct.nk : dik;
+      };
+
+      // fourier transform of the convolution kernels for each atom pair: lower triangle plus its hermitian conjugate of the \
+         valley_1-valley_1 block (k_11), and the anti-triangular valley_1-valley_2 block (k_12) and its hermitian conjugate (k_21)
+      arma::cx_mat k_11_hat(n_fft,4), k_12_hat(n_fft,4), k_21_hat(n_fft,4);
+      for (int i_pair=0; i_pair<4; i_pair++)
+      {
+        arma::cx_vec k_11(n_fft,arma::fill::zeros), k_12(n_fft,arma::fill::zeros), k_21(n_fft,arma::fill::zeros);
+        for (int lag=-(n-1); lag<n; lag++)
+        {
+          const int idx = (lag+n_fft)%n_fft;
+          if (lag > 0){
+            k_11(idx) = W(lag,0)[i_pair];
+            k_21(idx) = std::conj(W(wrap_dik(dik_12-lag),dmu_12)[i_pair]);
+          } else if (lag < 0){
+            k_11(idx) = std::conj(W(-lag,0)[i_pair]);
+            k_12(idx) = W(wrap_dik(lag+dik_12),dmu_12)[i_pair];
+          } else {
+            k_11(idx) = std::real(W(0,0)[i_pair]);
+            k_12(idx) = W(wrap_dik(dik_12),dmu_12)[i_pair];
+            k_21(idx) = std::conj(k_12(idx));
+          }
+        }
+        k_11_hat.col(i_pair) = arma::fft(k_11);
+        k_12_hat.col(i_pair) = arma::fft(k_12);
+        k_21_hat.col(i_pair) = arma::fft(k_21);
+      }
 
-      // interaction  between valley_1 and valley_1
-      for (int ik_cp_idx=0; ik_cp_idx<=ik_c_idx; ik_cp_idx++)
+      // the diagonal of the valley_1-valley_2 block is counted twice by the convolutions
+      arma::cx_vec diag_12(n,arma::fill::zeros);
+      for (int a=0; 2*a<=n-1; a++)
       {
-        ik_cp = _relev_ik_range[i_valley_1][ik_cp_idx][0];
-        mu_cp = _relev_ik_range[i_valley_1][ik_cp_idx][1];
-        ik_vp = get_ikv(ik_cp,ik_cm);
-        mu_vp = mu_cp;
+        const int b = n-1-a;
+        const std::complex<double>* w = W(wrap_dik(a-b+dik_12),dmu_12);
+        std::complex<double> dir_interaction = 0;
+        for (int i_pair=0; i_pair<4; i_pair++)
+        {
+          dir_interaction += F1(a,i_pair)*std::conj(F2(b,i_pair))*w[i_pair];
+        }
+        diag_12(a) = std::real(dir_interaction);
+      }
+
+      // exchange interaction in terms of the diagonal form factors u(state,i) = conj(psi_c(i))*psi_v(i)
+      const arma::cx_mat U = F1.cols(arma::uvec{0,3});
+      const arma::cx_mat V_x = {{vq_cm[0], vq_cm[1]}, {vq_cm[2], vq_cm[3]}};
+      const arma::cx_mat V_x_diag = 0.5*(V_x+V_x.t());
+
+      // linear convolution of each column of Z with a kernel given the zero padded fft of both
+      auto convolve = [&](const arma::cx_mat& Z_hat, const arma::cx_vec& k_hat){
+        arma::cx_mat Y = Z_hat;
+        Y.each_col() %= k_hat;
+        const arma::cx_mat Y_padded = arma::ifft(Y);
+        return arma::cx_mat(Y_padded.head_rows(n));
+      };
+
+      // action of the kernel on a block of vectors: K_11 + sign_12*K_12 + exchange_factor*K_exchange
+      auto apply_kernel = [&](const arma::cx_mat& X, arma::cx_mat& Y, const double sign_12, const double exchange_factor){
+        Y = X;
+        Y.each_col() %= transition_energy;
+        const arma::cx_mat X_flip = arma::flipud(X);
+        for (int i_pair=0; i_pair<4; i_pair++)
+        {
+          arma::cx_mat Z_1 = X;
+          Z_1.each_col() %= arma::conj(F1.col(i_pair));
+          arma::cx_mat Z_2 = X_flip;
+          Z_2.each_col() %= arma::conj(F2.col(i_pair));
+          const arma::cx_mat Z_1_hat = arma::fft(Z_1,n_fft);
+          const arma::cx_mat Z_2_hat = arma::fft(Z_2,n_fft);
+
+          // interaction  between valley_1 and valley_1
+          arma::cx_mat Y_11 = convolve(Z_1_hat, k_11_hat.col(i_pair));
+          Y_11.each_col() %= F1.col(i_pair);
+          Y -= Y_11;
+
+          // interaction  between valley_1 and valley_2
+          arma::cx_mat Y_12 = convolve(Z_2_hat, k_12_hat.col(i_pair));
+          Y_12.each_col() %= F1.col(i_pair);
+          arma::cx_mat Y_21 = convolve(Z_1_hat, k_21_hat.col(i_pair));
+          Y_21.each_col() %= F2.col(i_pair);
+          Y -= sign_12*(Y_12+arma::flipud(Y_21));
+        }
+        arma::cx_mat Y_diag = X;
+        Y_diag.each_col() %= diag_12;
+        Y += sign_12*Y_diag;
+
+        if (exchange_factor != 0)
+        {
+          for (int i_col=0; i_col<int(X.n_cols); i_col++)
+          {
+            arma::cx_mat G = arma::conj(U);
+            G.each_col() %= X.col(i_col);
+            const arma::cx_mat G_sum = arma::cumsum(G);
+            const arma::cx_mat P = G_sum-G; // sum over states before each state
+            const arma::cx_mat Q = arma::repmat(G_sum.row(n-1),n,1)-G_sum; // sum over states after each state
+            const arma::cx_mat Y_x = U%(P*V_x.st() + Q*arma::conj(V_x) + G*V_x_diag.st());
+            Y.col(i_col) += exchange_factor*std::complex<double>(2,0)*arma::sum(Y_x,1);
+          }
+        }
+      };
+
+      auto solve = [&](const double sign_12, const double exchange_factor, const double valley_2_sign, arma::mat& ex_energy, \
+                       arma::cx_cube& ex_psi, int& n_found){
+        arma::vec energy;
+        arma::cx_mat psi;
+        lanczos_eig_sym(energy, psi, [&](const arma::cx_mat& X, arma::cx_mat& Y){apply_kernel(X,Y,sign_12,exchange_factor);}, \
+                        n, n_states);
+        const int n_below_cutoff = arma::uvec(arma::find(energy < _exciton_energy_cutoff)).n_elem;
+        store_states(energy.head(n_below_cutoff), psi.head_cols(n_below_cutoff), valley_2_sign, ik_cm_idx, ex_energy, ex_psi, n_found);
+      };
+
+      solve(-1, 0, -1, ex_energy_A1, ex_psi_A1, n_found_local[0]);
+
+      solve(+1, 0, +1, ex_energy_A2_triplet, ex_psi_A2_triplet, n_found_local[1]);
+
+      solve(+1, 2, +1, ex_energy_A2_singlet, ex_psi_A2_singlet, n_found_local[2]);
+    };
+
+    // loop to calculate exciton dispersion
+    #pragma omp for schedule(dynamic)
+    for (int ik_cm_idx=0; ik_cm_idx<nk_cm; ik_cm_idx++)
+    {
+      const int ik_cm = ik_cm_range[0] + ik_cm_idx;
+      const int mu_cm = 0;
+      k_cm_vec(ik_cm_idx) = ik_cm*arma::norm(_dk_l);
 
-        kernel_11(ik_c_idx,ik_cp_idx) -= get_direct_interaction();
-        kernel_exchange(ik_c_idx,ik_cp_idx) += std::complex<double>(2,0)*get_exchange_interaction();
+      // fill the per state tables and save the index of kc and kv states. in valley_1 the conduction band states and \
+         in valley_2 the valence band states are taken from the relevant ik range.
+      for (int i_valley=0; i_valley<2; i_valley++)
+      {
+        for (int ik_relev_idx=0; ik_relev_idx<nk_relev; ik_relev_idx++)
+        {
+          int ik_c, ik_v;
+          const int mu_c = _relev_ik_range[i_valley][ik_relev_idx][1];
+          if (i_valley == i_valley_1){
+            ik_c = _relev_ik_range[i_valley][ik_relev_idx][0];
+            ik_v = get_ikv(ik_c,ik_cm);
+          } else {
+            ik_v = _relev_ik_range[i_valley][ik_relev_idx][0];
+            ik_c = get_ikc(ik_v,ik_cm);
+          }
+          const int ik_c_idx = ik_c-elec_struct.ik_range[0];
+          const int ik_v_idx = ik_v-elec_struct.ik_range[0];
+          const int mu_idx = mu_c-elec_struct.mu_range[0];
+          const arma::cx_cube& psi = elec_struct.wavefunc(mu_idx);
+
+          state_ik_idx[i_valley][ik_relev_idx] = ik_c_idx;
+          state_mu[i_valley][ik_relev_idx] = mu_c;
+          for (int i=0; i<2; i++)
+          {
+            for (int j=0; j<2; j++)
+            {
+              state_ff[i_valley][4*ik_relev_idx+2*i+j] = std::conj(psi(i,ic,ik_c_idx))*psi(j,iv,ik_v_idx);
+            }
+          }
+
+          if (i_valley == i_valley_1){
+            transition_energy(ik_relev_idx) = elec_struct.energy(ic,ik_c_idx,mu_idx) - elec_struct.energy(iv,ik_v_idx,mu_idx);
+          }
+
+          const int col = (i_valley == i_valley_1) ? ik_relev_idx : nk_c-1-ik_relev_idx;
+          ik_idx(0,col,ik_cm_idx) = ik_c_idx;
+          ik_idx(1,col,ik_cm_idx) = mu_idx;
+          ik_idx(2,col,ik_cm_idx) = ik_v_idx;
+          ik_idx(3,col,ik_cm_idx) = mu_idx;
+        }
       }
 
-      // interaction  between valley_1 and valley_2
-      for (int ik_vp_idx=ik_c_idx; ik_vp_idx<nk_relev; ik_vp_idx++)
+      // exchange interaction only depends on the center of mass momentum
+      std::array<std::complex<double>,4> vq_cm;
+      for (int i_pair=0; i_pair<4; i_pair++)
       {
-        ik_vp = _relev_ik_range[i_valley_2][ik_vp_idx][0];
-        mu_vp = _relev_ik_range[i_valley_2][ik_vp_idx][1];
-        ik_cp = get_ikc(ik_vp,ik_cm);
-        mu_cp = mu_vp;
+        vq_cm[i_pair] = _vq(ik_cm,mu_cm,i_pair);
+      }
 
-        kernel_12(ik_c_idx,nk_relev-1-ik_vp_idx) -= get_direct_interaction();
+      if (_exciton_solver == exciton_lanczos)
+      {
+        solve_lanczos(ik_cm_idx, vq_cm);
       }
-    }
+      else
+      {
+        kernel_11.zeros();
+        kernel_12.zeros();
+        kernel_exchange.zeros();
+        kernel_11.diag() += transition_energy;
 
-    kernel_11 += kernel_11.t();
-    kernel_12 += kernel_12.t();
-    kernel_exchange += kernel_exchange.t();
-    for (int ik_c_idx=0; ik_c_idx<nk_relev; ik_c_idx++)
-    {
-      kernel_11(ik_c_idx,ik_c_idx) /= std::complex<double>(2,0);
-      kernel_12(ik_c_idx,ik_c_idx) /= std::complex<double>(2,0);
-      kernel_exchange(ik_c_idx,ik_c_idx) /= std::complex<double>(2,0);
-    }
+        for (int ik_c_idx=0; ik_c_idx<nk_relev; ik_c_idx++)
+        {
+          const std::complex<double>* ff = &state_ff[i_valley_1][4*ik_c_idx];
+          const int ik = state_ik_idx[i_valley_1][ik_c_idx];
+          const int mu = state_mu[i_valley_1][ik_c_idx];
+
+          // interaction  between valley_1 and valley_1
+          for (int ik_cp_idx=0; ik_cp_idx<=ik_c_idx; ik_cp_idx++)
+          {
+            const std::complex<double>* ffp = &state_ff[i_valley_1][4*ik_cp_idx];
+            const std::complex<double>* w = W(ik-state_ik_idx[i_valley_1][ik_cp_idx], mu-state_mu[i_valley_1][ik_cp_idx]);
+
+            std::complex<double> dir_interaction = 0;
+            for (int i_pair=0; i_pair<4; i_pair++)
+            {
+              dir_interaction += ff[i_pair]*std::conj(ffp[i_pair])*w[i_pair];
+            }
+            const std::complex<double> xch_interaction = ff[0]*(std::conj(ffp[0])*vq_cm[0] + std::conj(ffp[3])*vq_cm[1]) + \
+                                                         ff[3]*(std::conj(ffp[0])*vq_cm[2] + std::conj(ffp[3])*vq_cm[3]);
+
+            kernel_11(ik_c_idx,ik_cp_idx) -= dir_interaction;
+            kernel_exchange(ik_c_idx,ik_cp_idx) += std::complex<double>(2,0)*xch_interaction;
+          }
+
+          // interaction  between valley_1 and valley_2
+          for (int ik_vp_idx=ik_c_idx; ik_vp_idx<nk_relev; ik_vp_idx++)
+          {
+            const std::complex<double>* ffp = &state_ff[i_valley_2][4*ik_vp_idx];
+            const std::complex<double>* w = W(ik-state_ik_idx[i_valley_2][ik_vp_idx], mu-state_mu[i_valley_2][ik_vp_idx]);
+
+            std::complex<double> dir_interaction = 0;
+            for (int i_pair=0; i_pair<4; i_pair++)
+            {
+              dir_interaction += ff[i_pair]*std::conj(ffp[i_pair])*w[i_pair];
+            }
+
+            kernel_12(ik_c_idx,nk_relev-1-ik_vp_idx) -= dir_interaction;
+          }
+        }
 
-    arma::eig_sym(energy,psi,kernel_11-kernel_12);
-    ex_energy_A1.row(ik_cm_idx) = energy.t();
-    ex_psi_A1.slice(ik_cm_idx).head_rows(nk_relev) = (+1/std::sqrt(2.))*psi;
-    ex_psi_A1.slice(ik_cm_idx).tail_rows(nk_relev) = (-1/std::sqrt(2.))*psi;
+        kernel_11 += kernel_11.t();
+        kernel_12 += kernel_12.t();
+        kernel_exchange += kernel_exchange.t();
+        for (int ik_c_idx=0; ik_c_idx<nk_relev; ik_c_idx++)
+        {
+          kernel_11(ik_c_idx,ik_c_idx) /= std::complex<double>(2,0);
+          kernel_12(ik_c_idx,ik_c_idx) /= std::complex<double>(2,0);
+          kernel_exchange(ik_c_idx,ik_c_idx) /= std::complex<double>(2,0);
+        }
 
-    // energy = arma::eig_sym(kernel_11+kernel_12);
-    arma::eig_sym(energy,psi,kernel_11+kernel_12);
-    ex_energy_A2_triplet.row(ik_cm_idx) = energy.t();
-    ex_psi_A2_triplet.slice(ik_cm_idx).head_rows(nk_relev) = (+1/std::sqrt(2.))*psi;
-    ex_psi_A2_triplet.slice(ik_cm_idx).tail_rows(nk_relev) = (+1/std::sqrt(2.))*psi;
+        solve_kernel(kernel_11-kernel_12, -1, ik_cm_idx, ex_energy_A1, ex_psi_A1, n_found_local[0]);
 
-    // energy = arma::eig_sym(kernel_11+kernel_12+std::complex<double>(2,0)*kernel_exchange);
-    arma::eig_sym(energy,psi,kernel_11+kernel_12+std::complex<double>(2,0)*kernel_exchange);
-    ex_energy_A2_singlet.row(ik_cm_idx) = energy.t();
-    ex_psi_A2_singlet.slice(ik_cm_idx).head_rows(nk_relev) = (+1/std::sqrt(2.))*psi;
-    ex_psi_A2_singlet.slice(ik_cm_idx).tail_rows(nk_relev) = (+1/std::sqrt(2.))*psi;
+        solve_kernel(kernel_11+kernel_12, +1, ik_cm_idx, ex_energy_A2_triplet, ex_psi_A2_triplet, n_found_local[1]);
 
+        solve_kernel(kernel_11+kernel_12+std::complex<double>(2,0)*kernel_exchange, +1, ik_cm_idx, ex_energy_A2_singlet, ex_psi_A2_singlet, n_found_local[2]);
+      }
 
-    // save the index of kc and kv states from i_valley_1
-    for (int ik_c_idx=0; ik_c_idx<nk_relev; ik_c_idx++)
-    {
-      ik_c = _relev_ik_range[i_valley_1][ik_c_idx][0];
-      mu_c = _relev_ik_range[i_valley_1][ik_c_idx][1];
-      ik_v = get_ikv(ik_c,ik_cm);
-      mu_v = mu_c;
-
-      ik_idx(0,ik_c_idx,ik_cm_idx) = ik_c-elec_struct.ik_range[0];
-      ik_idx(1,ik_c_idx,ik_cm_idx) = mu_c-elec_struct.mu_range[0];
-      ik_idx(2,ik_c_idx,ik_cm_idx) = ik_v-elec_struct.ik_range[0];
-      ik_idx(3,ik_c_idx,ik_cm_idx) = mu_v-elec_struct.mu_range[0];
+      #pragma omp critical (ex_energy_progress)
+      prog.step();
     }
 
-    // save the index of kc and kv states from i_valley_2
-    for (int ik_v_idx=0; ik_v_idx<nk_relev; ik_v_idx++)
+    #pragma omp critical (ex_energy_found_states)
+    for (int i=0; i<3; i++)
     {
-      ik_v = _relev_ik_range[i_valley_2][ik_v_idx][0];
-      mu_v = _relev_ik_range[i_valley_2][ik_v_idx][1];
-      ik_c = get_ikc(ik_v,ik_cm);
-      mu_c = mu_v;
-
-      ik_idx(0,nk_c-1-ik_v_idx,ik_cm_idx) = ik_c-elec_struct.ik_range[0];
-      ik_idx(1,nk_c-1-ik_v_idx,ik_cm_idx) = mu_c-elec_struct.mu_range[0];
-      ik_idx(2,nk_c-1-ik_v_idx,ik_cm_idx) = ik_v-elec_struct.ik_range[0];
-      ik_idx(3,nk_c-1-ik_v_idx,ik_cm_idx) = mu_v-elec_struct.mu_range[0];
+      n_found_states[i] = std::max(n_found_states[i], n_found_local[i]);
     }
-
   }
+  blas_threads.restore();
 
   std::cout << "\n...calculated exciton dispersion\n";
 
+  // shrink the exciton matrices to the number of states that are actually found below the energy cutoff
+  if (partial_spectrum)
+  {
+    ex_energy_A1.resize(nk_cm,n_found_states[0]);
+    ex_psi_A1.resize(nk_c,n_found_states[0],nk_cm);
+    ex_energy_A2_triplet.resize(nk_cm,n_found_states[1]);
+    ex_psi_A2_triplet.resize(nk_c,n_found_states[1],nk_cm);
+    ex_energy_A2_singlet.resize(nk_cm,n_found_states[2]);
+    ex_psi_A2_singlet.resize(nk_c,n_found_states[2],nk_cm);
+    std::cout << "number of exciton states: A1: " << n_found_states[0] << ", A2 triplet: " << n_found_states[1] \
+              << ", A2 singlet: " << n_found_states[2] << " out of " << nk_relev << "\n";
+  }
+
   std::cout << "saved exciton dispersion: A2 singlet\n";
   std::string filename = _directory.path()/"ex_energy_A2_singlet.dat";
   ex_energy_A2_singlet.save(filename, arma::arma_ascii);
@@ -1021,7 +1604,7 @@ std::vector<cnt::exciton_struct> cnt::calculate_A_excitons(const std::array<int,
   excitons[0].energy = ex_energy_A1;
   excitons[0].spin = 0;
   excitons[0].mu_cm = 0;
-  excitons[0].n_principal = nk_relev;
+  excitons[0].n_principal = ex_energy_A1.n_cols;
   excitons[0].nk_c = nk_c;
   excitons[0].nk_cm = nk_cm;
   excitons[0].psi = ex_psi_A1;
@@ -1032,7 +1615,7 @@ std::vector<cnt::exciton_struct> cnt::calculate_A_excitons(const std::array<int,
   excitons[1].energy = ex_energy_A2_triplet;
   excitons[1].spin = 1;
   excitons[1].mu_cm = 0;
-  excitons[1].n_principal = nk_relev;
+  excitons[1].n_principal = ex_energy_A2_triplet.n_cols;
   excitons[1].nk_c = nk_c;
   excitons[1].nk_cm = nk_cm;
   excitons[1].psi = ex_psi_A2_triplet;
@@ -1043,7 +1626,7 @@ std::vector<cnt::exciton_struct> cnt::calculate_A_excitons(const std::array<int,
   excitons[2].energy = ex_energy_A2_singlet;
   excitons[2].spin = 0;
   excitons[2].mu_cm = 0;
-  excitons[2].n_principal = nk_relev;
+  excitons[2].n_principal = ex_energy_A2_singlet.n_cols;
   excitons[2].nk_c = nk_c;
   excitons[2].nk_cm = nk_cm;
   excitons[2].psi = ex_psi_A2_singlet;
@@ -1068,15 +1651,24 @@ void cnt::calculate_exciton_dispersion()
   find_valleys(_elec_K2);
   find_relev_ik_range(1.*constants::eV, _elec_K2);
 
+  // range of center of mass momentum for exciton dispersion
+  std::array<int,2> ik_cm_range = {-int(_relev_ik_range[0].size()), int(_relev_ik_range[0].size())};
+
+  // in sparse mode only the momentum transfers that are used in the exciton kernel are calculated
+  std::shared_ptr<const q_index_struct> q_points = nullptr;
+  if (_use_sparse_q)
+  {
+    q_points = find_relevant_q_transfers(ik_cm_range, _elec_K2);
+  }
+
   // calculate vq, and dielectric function for a sufficiently large range of mu and ik.
   std::array<int,2> iq_range = {-(_elec_K2.ik_range[1]-1),_elec_K2.ik_range[1]};
   std::array<int,2> mu_range = {-(_elec_K2.mu_range[1]-1),_elec_K2.mu_range[1]};
-  _vq = calculate_vq(iq_range, mu_range, _number_of_cnt_unit_cells);
-  _PI = calculate_polarization(iq_range, mu_range, _elec_K2);
-  _eps = calculate_dielectric(iq_range, mu_range);
+  _vq = calculate_vq(iq_range, mu_range, _number_of_cnt_unit_cells, q_points);
+  _PI = calculate_polarization(iq_range, mu_range, _elec_K2, q_points);
+  _eps = calculate_dielectric(iq_range, mu_range, q_points);
 
   // calculate exciton dispersions using the information calculated above
-  std::array<int,2> ik_cm_range = {-int(_relev_ik_range[0].size()), int(_relev_ik_range[0].size())};
   _excitons = calculate_A_excitons(ik_cm_range, _elec_K2);
 
 }
\ No newline at end of file
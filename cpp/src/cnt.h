@@ -3,6 +3,8 @@
 
 #include <iostream>
 #include <string>
+#include <memory>
+#include <unordered_map>
 #include <experimental/filesystem>
 #include <armadillo>
 
@@ -22,6 +24,15 @@ private:
 
   enum length_units {nanometer, meter, cnt_unit_cell};
 
+  enum vq_methods {vq_direct, vq_fft}; // methods to calculate vq: direct summation or fft along the cnt axis
+  vq_methods _vq_method = vq_direct; // method used in calculate_vq
+  bool _use_q_symmetry = false; // if true only the irreducible half of vq and PI is calculated and stored
+  bool _use_sparse_q = false; // if true vq, PI, and epsilon are only calculated for (iq,mu) points used in the exciton kernel
+  int _n_exciton_states = 0; // number of lowest exciton states per center of mass momentum, zero or negative means all states
+  double _exciton_energy_cutoff = arma::datum::inf; // only exciton states below this energy are calculated
+  enum exciton_solvers {exciton_dense, exciton_lanczos}; // solvers of the exciton kernel: dense eigen solver or matrix-free lanczos
+  exciton_solvers _exciton_solver = exciton_dense; // solver used in calculate_A_excitons
+
   const double _a_cc = 1.42e-10; // carbon-carbon distance [meters]
   const double _a_l = std::sqrt(float(3.0))*_a_cc; // graphene lattice constants [meters]
 
@@ -81,6 +92,45 @@ private:
   // instantiation of el_energy_struct within K2-extended representation
   el_energy_struct _elec_K2;
 
+public:
+  // struct to hold a sparse set of (iq,mu) points together with a compact index to find them
+  struct q_index_struct
+  {
+    std::vector<std::array<int,2>> points; // list of (iq,mu) points
+    std::unordered_map<long long,int> index; // position of each (iq,mu) point in the points vector
+
+    // unique key of an (iq,mu) point for the hash table
+    static long long key(const int& iq, const int& mu)
+    {
+      return static_cast<long long>(iq)*(1LL<<32) + static_cast<unsigned int>(mu);
+    };
+
+    // add an (iq,mu) point to the set if it is not already there
+    void insert(const int& iq, const int& mu)
+    {
+      if (index.emplace(key(iq,mu),int(points.size())).second){
+        points.push_back({iq,mu});
+      }
+    };
+
+    // position of an (iq,mu) point in the points vector
+    int find(const int& iq, const int& mu) const
+    {
+      const auto it = index.find(key(iq,mu));
+      if (it == index.end()){
+        throw std::out_of_range("(iq,mu) = (" + std::to_string(iq) + "," + std::to_string(mu) + ") is not in the sparse set of q points");
+      }
+      return it->second;
+    };
+
+    // number of points in the set
+    int size() const
+    {
+      return int(points.size());
+    };
+  };
+
+private:
   // struct to bundle data and metadata of coulomg interaction fourier transform (vq)
   struct vq_struct
   {
@@ -88,10 +138,38 @@ private:
     std::array<int,2> iq_range; // range of iq values in the half-open range format [a,b)
     std::array<int,2> mu_range; // range of mu values in the half-open range format [a,b)
     int nq, n_mu; // number of iq and mu elements
+    bool symmetric = false; // if true only iq>=0 half of the range is stored in data and the rest is served using vq(-q,-mu) = conj(vq(q,mu))
+    std::shared_ptr<const q_index_struct> sparse_points; // if set only these (iq,mu) points are stored in data in the format (point_idx,0,atom_pair_index)
+
+    // access vq for actual values of iq and mu regardless of the storage format
+    std::complex<double> operator()(const int& iq, const int& mu, const int& i_pair) const
+    {
+      if (sparse_points){
+        return data(sparse_points->find(iq,mu),0,i_pair);
+      }
+      if (not symmetric){
+        return data(iq-iq_range[0],mu-mu_range[0],i_pair);
+      }
+      if (iq < 0){
+        return std::conj(data(-iq,-mu-mu_range[0],i_pair));
+      }
+      return data(iq,mu-mu_range[0],i_pair);
+    };
   };
   // instantiation of vq_struct to hold data of vq calculated via calculate_vq function
   vq_struct _vq;
 
+  // struct to hold the q-independent part of the Ohno potential in a structure-of-arrays layout. elements are stored \
+     for each atom pair slice (aa=0, ab=1, ba=2, bb=3) in the order of (cnt unit cell, atom) where the cnt unit cell \
+     index runs from -n_cells/2 to +n_cells/2
+  struct ohno_weights_struct
+  {
+    std::array<std::vector<double>,4> x, y; // relative position of atom pairs in the unrolled graphene sheet
+    std::array<std::vector<double>,4> w; // Ohno potential for the relative position of each atom pair
+    int n_cells; // number of cnt unit cells included in the weights
+    int n_elem; // number of elements in each atom pair slice
+  };
+
   // struct to bundle data and metadata of electronic state polarization (PI)
   struct PI_struct
   {
@@ -99,6 +177,23 @@ private:
     std::array<int,2> iq_range; // range of iq values in the half-open range format [a,b)
     std::array<int,2> mu_range; // range of mu values in the half-open range format [a,b)
     int nq, n_mu; // number of iq and mu elements
+    bool symmetric = false; // if true only iq>=0 half of the range is stored in data and the rest is served using PI(-q,-mu) = PI(q,mu)
+    std::shared_ptr<const q_index_struct> sparse_points; // if set only these (iq,mu) points are stored in data in the format (point_idx,0)
+
+    // access PI for actual values of iq and mu regardless of the storage format
+    double operator()(const int& iq, const int& mu) const
+    {
+      if (sparse_points){
+        return data(sparse_points->find(iq,mu),0);
+      }
+      if (not symmetric){
+        return data(iq-iq_range[0],mu-mu_range[0]);
+      }
+      if (iq < 0){
+        return data(-iq,-mu-mu_range[0]);
+      }
+      return data(iq,mu-mu_range[0]);
+    };
   };
   // instantiation of PI_struct to hold data of PI calculated via calculate_polarization function
   PI_struct _PI;
@@ -110,10 +205,37 @@ private:
     std::array<int,2> iq_range; // range of iq values in the half-open range format [a,b)
     std::array<int,2> mu_range; // range of mu values in the half-open range format [a,b)
     int nq, n_mu; // number of iq and mu elements
+    std::shared_ptr<const q_index_struct> sparse_points; // if set only these (iq,mu) points are stored in data in the format (point_idx,0)
+
+    // access dielectric function for actual values of iq and mu regardless of the storage format
+    double operator()(const int& iq, const int& mu) const
+    {
+      if (sparse_points){
+        return data(sparse_points->find(iq,mu),0);
+      }
+      return data(iq-iq_range[0],mu-mu_range[0]);
+    };
   };
   // instantiation of epsilon_struct to hold data of dielectric function calculated via calculate_dielectric function
   epsilon_struct _eps;
 
+  // struct to hold the screened interaction W(q,mu) = vq(q,mu)/eps(q,mu) used in the direct term of the exciton kernel \
+     in a flat layout. iq is wrapped into the ik_range of the electronic states and mu spans the differences between \
+     the mu values of the relevant states.
+  struct screened_interaction_struct
+  {
+    std::vector<std::complex<double>> data; // W in the format of (iq,mu,atom_pair_index) with atom_pair_index running fastest
+    std::vector<int> iq_idx; // row of data for each difference of ik indices (ik_idx-ikp_idx+nk-1) after wrapping into ik_range
+    std::array<int,2> mu_range; // range of mu differences in the half-open range format [a,b)
+    int nk, n_mu; // number of ik and mu elements
+
+    // pointer to the four atom pair elements of W for the difference of ik indices and mu values of two states
+    const std::complex<double>* operator()(const int& dik_idx, const int& dmu) const
+    {
+      return &data[4*(iq_idx[dik_idx+nk-1]*n_mu + dmu-mu_range[0])];
+    };
+  };
+
   int _i_sub = 0; // index of the selected subband from _valleys_K2 vector
 
   arma::cx_vec _epsilon; // static dielectric function
@@ -191,6 +313,63 @@ public:
     _number_of_cnt_unit_cells = length;
     std::cout << "cnt length: " << _number_of_cnt_unit_cells << " " << units << "\n";
 
+    // set the method to calculate vq
+    if (j.find("vq method")!= j.end())
+    {
+      std::string vq_method = j["vq method"];
+      if (vq_method == "direct") {
+        _vq_method = vq_direct;
+      } else if (vq_method == "fft") {
+        _vq_method = vq_fft;
+      } else {
+        throw std::invalid_argument("vq method should be either \"direct\" or \"fft\"!!!");
+      }
+      std::cout << "vq method: " << vq_method << "\n";
+    }
+
+    // use the symmetry of vq and PI under (q,mu) -> (-q,-mu)
+    if (j.find("use q symmetry")!= j.end())
+    {
+      _use_q_symmetry = j["use q symmetry"];
+      std::cout << "use q symmetry: " << std::boolalpha << _use_q_symmetry << "\n";
+    }
+
+    // calculate vq, PI, and epsilon only for the momentum transfers that the exciton kernel needs
+    if (j.find("sparse q transfers")!= j.end())
+    {
+      _use_sparse_q = j["sparse q transfers"];
+      std::cout << "sparse q transfers: " << std::boolalpha << _use_sparse_q << "\n";
+    }
+
+    // calculate only part of the exciton spectrum
+    if (j.find("number of exciton states")!= j.end())
+    {
+      _n_exciton_states = j["number of exciton states"];
+      std::cout << "number of exciton states: " << _n_exciton_states << "\n";
+    }
+    if (j.find("exciton energy cutoff [eV]")!= j.end())
+    {
+      _exciton_energy_cutoff = double(j["exciton energy cutoff [eV]"])*constants::eV;
+      std::cout << "exciton energy cutoff: " << _exciton_energy_cutoff/constants::eV << " [eV]\n";
+    }
+
+    // solver of the exciton kernel
+    if (j.find("exciton solver")!= j.end())
+    {
+      std::string exciton_solver = j["exciton solver"];
+      if (exciton_solver == "dense") {
+        _exciton_solver = exciton_dense;
+      } else if (exciton_solver == "lanczos") {
+        _exciton_solver = exciton_lanczos;
+        if (_n_exciton_states <= 0){
+          throw std::invalid_argument("lanczos exciton solver needs \"number of exciton states\" to be set!!!");
+        }
+      } else {
+        throw std::invalid_argument("exciton solver should be either \"dense\" or \"lanczos\"!!!");
+      }
+      std::cout << "exciton solver: " << exciton_solver << "\n";
+    }
+
   };
 
   // calculate the parameters of the cnt
@@ -214,14 +393,26 @@ public:
   // find ik values that are energetically relevant around the bottom of the valley
   void find_relev_ik_range(double delta_energy, const el_energy_struct& elec_struct);
 
-  // fourier transformation of the coulomb interaction a.k.a v(q)
-  vq_struct calculate_vq(const std::array<int,2> iq_range, const std::array<int,2> mu_range, const unsigned int no_of_cnt_unit_cells);
+  // q-independent part of the Ohno potential for all relative positions between atoms
+  ohno_weights_struct calculate_ohno_weights(const unsigned int no_of_cnt_unit_cells) const;
+
+  // find the set of (iq,mu) momentum transfers that are used in the exciton kernel by calculate_A_excitons
+  std::shared_ptr<const q_index_struct> find_relevant_q_transfers(const std::array<int,2> ik_cm_range, const el_energy_struct& elec_struct) const;
+
+  // fourier transformation of the coulomb interaction a.k.a v(q). if sparse_points is set only those points are calculated
+  vq_struct calculate_vq(const std::array<int,2> iq_range, const std::array<int,2> mu_range, const unsigned int no_of_cnt_unit_cells, \
+                         const std::shared_ptr<const q_index_struct>& sparse_points=nullptr);
+
+  // polarization of electronic states a.k.a PI(q). if sparse_points is set only those points are calculated
+  PI_struct calculate_polarization(const std::array<int,2> iq_range, const std::array<int,2> mu_range, const el_energy_struct& elec_struct, \
+                                   const std::shared_ptr<const q_index_struct>& sparse_points=nullptr);
 
-  // polarization of electronic states a.k.a PI(q)
-  PI_struct calculate_polarization(const std::array<int,2> iq_range, const std::array<int,2> mu_range, const el_energy_struct& elec_struct);
+  // dielectric function a.k.a eps(q). if sparse_points is set only those points are calculated
+  epsilon_struct calculate_dielectric(const std::array<int,2> iq_range, const std::array<int,2> mu_range, \
+                                      const std::shared_ptr<const q_index_struct>& sparse_points=nullptr);
 
-  // dielectric function a.k.a eps(q)
-  epsilon_struct calculate_dielectric(const std::array<int,2> iq_range, const std::array<int,2> mu_range);
+  // screened interaction vq/eps for all momentum transfers between the relevant states used in the exciton kernel
+  screened_interaction_struct calculate_screened_interaction(const el_energy_struct& elec_struct) const;
 
   // calculate exciton dispersion
   std::vector<exciton_struct> calculate_A_excitons(const std::array<int,2> ik_cm_range, const el_energy_struct& elec_struct);
@@ -258,6 +449,12 @@ public:
     return true;
   };
 
+  // helper function to check if a range is symmetric around zero in the half-open range format [-(b-1),b)
+  bool is_symmetric(const std::array<int,2>& range) const
+  {
+    return (range[0] == -(range[1]-1));
+  };
+
   // getter function to access cnt radius
   const double& radius() const
   {
@@ -0,0 +1,134 @@
+#include <cmath>
+#include <immintrin.h>
+
+#include "coulomb_kernel.h"
+
+namespace
+{
+  typedef std::complex<double> (*kernel_type)(const double&, const double&, const double&, const double*, const double*, \
+                                              const double*, const double*, const double*, const int&);
+
+  // plain loop used for cpus without avx2 and for the remainder of the vectorized loops
+  std::complex<double> kernel_scalar(const double& x, const double& y, const double& z, const double* xs, const double* ys, \
+                                     const double* zs, const double* q_real, const double* q_imag, const int& n)
+  {
+    double phi_real = 0;
+    double phi_imag = 0;
+    for (int j=0; j<n; j++)
+    {
+      const double dx = x-xs[j];
+      const double dy = y-ys[j];
+      const double dz = z-zs[j];
+      const double inv_r = 1./std::sqrt(dx*dx+dy*dy+dz*dz);
+      phi_real += q_real[j]*inv_r;
+      phi_imag += q_imag[j]*inv_r;
+    }
+    return std::complex<double>(phi_real,phi_imag);
+  };
+
+  // avx2 has no double precision reciprocal square root, so the exact square root and division are used
+  __attribute__((target("avx2,fma")))
+  std::complex<double> kernel_avx2(const double& x, const double& y, const double& z, const double* xs, const double* ys, \
+                                   const double* zs, const double* q_real, const double* q_imag, const int& n)
+  {
+    const __m256d x_vec = _mm256_set1_pd(x);
+    const __m256d y_vec = _mm256_set1_pd(y);
+    const __m256d z_vec = _mm256_set1_pd(z);
+    const __m256d one = _mm256_set1_pd(1.);
+    __m256d phi_real = _mm256_setzero_pd();
+    __m256d phi_imag = _mm256_setzero_pd();
+
+    const int n_vec = n-n%4;
+    for (int j=0; j<n_vec; j+=4)
+    {
+      const __m256d dx = _mm256_sub_pd(x_vec,_mm256_loadu_pd(xs+j));
+      const __m256d dy = _mm256_sub_pd(y_vec,_mm256_loadu_pd(ys+j));
+      const __m256d dz = _mm256_sub_pd(z_vec,_mm256_loadu_pd(zs+j));
+      const __m256d r2 = _mm256_fmadd_pd(dz,dz,_mm256_fmadd_pd(dy,dy,_mm256_mul_pd(dx,dx)));
+      const __m256d inv_r = _mm256_div_pd(one,_mm256_sqrt_pd(r2));
+      phi_real = _mm256_fmadd_pd(_mm256_loadu_pd(q_real+j),inv_r,phi_real);
+      phi_imag = _mm256_fmadd_pd(_mm256_loadu_pd(q_imag+j),inv_r,phi_imag);
+    }
+
+    alignas(32) double real_lanes[4], imag_lanes[4];
+    _mm256_store_pd(real_lanes,phi_real);
+    _mm256_store_pd(imag_lanes,phi_imag);
+    std::complex<double> phi((real_lanes[0]+real_lanes[1])+(real_lanes[2]+real_lanes[3]), \
+                             (imag_lanes[0]+imag_lanes[1])+(imag_lanes[2]+imag_lanes[3]));
+    return phi + kernel_scalar(x,y,z,xs+n_vec,ys+n_vec,zs+n_vec,q_real+n_vec,q_imag+n_vec,n-n_vec);
+  };
+
+  // avx-512 reciprocal square root estimate has 14 bits of accuracy, two newton-raphson iterations y*(3-r2*y^2)/2 bring it \
+     to full double precision.
+  __attribute__((target("avx512f")))
+  std::complex<double> kernel_avx512(const double& x, const double& y, const double& z, const double* xs, const double* ys, \
+                                     const double* zs, const double* q_real, const double* q_imag, const int& n)
+  {
+    const __m512d x_vec = _mm512_set1_pd(x);
+    const __m512d y_vec = _mm512_set1_pd(y);
+    const __m512d z_vec = _mm512_set1_pd(z);
+    const __m512d half = _mm512_set1_pd(0.5);
+    const __m512d three = _mm512_set1_pd(3.);
+    __m512d phi_real = _mm512_setzero_pd();
+    __m512d phi_imag = _mm512_setzero_pd();
+
+    const int n_vec = n-n%8;
+    for (int j=0; j<n_vec; j+=8)
+    {
+      const __m512d dx = _mm512_sub_pd(x_vec,_mm512_loadu_pd(xs+j));
+      const __m512d dy = _mm512_sub_pd(y_vec,_mm512_loadu_pd(ys+j));
+      const __m512d dz = _mm512_sub_pd(z_vec,_mm512_loadu_pd(zs+j));
+      const __m512d r2 = _mm512_fmadd_pd(dz,dz,_mm512_fmadd_pd(dy,dy,_mm512_mul_pd(dx,dx)));
+      __m512d inv_r = _mm512_rsqrt14_pd(r2);
+      for (int i_iter=0; i_iter<2; i_iter++)
+      {
+        const __m512d r2_inv_r2 = _mm512_mul_pd(r2,_mm512_mul_pd(inv_r,inv_r));
+        inv_r = _mm512_mul_pd(_mm512_mul_pd(half,inv_r),_mm512_sub_pd(three,r2_inv_r2));
+      }
+      phi_real = _mm512_fmadd_pd(_mm512_loadu_pd(q_real+j),inv_r,phi_real);
+      phi_imag = _mm512_fmadd_pd(_mm512_loadu_pd(q_imag+j),inv_r,phi_imag);
+    }
+
+    std::complex<double> phi(_mm512_reduce_add_pd(phi_real),_mm512_reduce_add_pd(phi_imag));
+    return phi + kernel_scalar(x,y,z,xs+n_vec,ys+n_vec,zs+n_vec,q_real+n_vec,q_imag+n_vec,n-n_vec);
+  };
+
+  // pick the widest instruction set that the cpu supports
+  kernel_type select_kernel(std::string& isa)
+  {
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")){
+      isa = "avx512";
+      return kernel_avx512;
+    }
+    if (__builtin_cpu_supports("avx2") and __builtin_cpu_supports("fma")){
+      isa = "avx2";
+      return kernel_avx2;
+    }
+    isa = "scalar";
+    return kernel_scalar;
+  };
+
+  struct dispatch_struct
+  {
+    std::string isa;
+    kernel_type kernel = select_kernel(isa);
+  };
+
+  const dispatch_struct& dispatch()
+  {
+    static const dispatch_struct d;
+    return d;
+  };
+}
+
+std::complex<double> coulomb_potential(const double& x, const double& y, const double& z, const double* xs, const double* ys, \
+                                       const double* zs, const double* q_real, const double* q_imag, const int& n)
+{
+  return dispatch().kernel(x,y,z,xs,ys,zs,q_real,q_imag,n);
+};
+
+std::string coulomb_kernel_isa()
+{
+  return dispatch().isa;
+};
@@ -0,0 +1,17 @@
+#ifndef _coulomb_kernel_h_
+#define _coulomb_kernel_h_
+
+#include <complex>
+#include <string>
+
+// direct sum of the coulomb potential sum_j q_j/|r-r_j| of n complex charges at the point r = (x, y, z). the position of \
+   the sources are given as separate x, y, and z arrays and the charges as separate real and imaginary arrays so that the \
+   sum can be vectorized. the instruction set (avx-512, avx2, or plain scalar code) is selected at runtime based on the \
+   cpu. all versions keep double precision accuracy.
+std::complex<double> coulomb_potential(const double& x, const double& y, const double& z, const double* xs, const double* ys, \
+                                       const double* zs, const double* q_real, const double* q_imag, const int& n);
+
+// name of the instruction set used by coulomb_potential on this cpu
+std::string coulomb_kernel_isa();
+
+#endif //_coulomb_kernel_h_
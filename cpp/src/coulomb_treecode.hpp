@@ -0,0 +1,237 @@
+#ifndef _coulomb_treecode_hpp_
+#define _coulomb_treecode_hpp_
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <complex>
+#include <stdexcept>
+#include <vector>
+
+#include "coulomb_kernel.h"
+
+// treecode (barnes-hut) evaluation of the coulomb potential phi(r) = sum_j q_j/|r-r_j| of a set of complex charges. the \
+   sources are grouped in a binary tree by recursive bisection along the longest side of their bounding box. cells that \
+   are far enough from the target point are replaced by their multipole expansion up to quadrupole order and the rest \
+   are summed directly. the relative error of a cell expansion is of the order of theta^3 where theta is the ratio of the \
+   cell radius to its distance from the target, so theta is chosen as the cubic root of the requested accuracy.
+class coulomb_treecode
+{
+private:
+  struct node_struct
+  {
+    int begin, end; // range of the sources of this node in the sorted order
+    std::array<double,3> center; // center of the bounding box of the sources
+    double radius; // distance of the farthest source from the center
+    std::array<int,2> children = {-1,-1}; // index of the child nodes, -1 for leaves
+  };
+
+  std::vector<node_struct> _nodes; // nodes of the tree, the root is the first element
+  std::array<std::vector<double>,3> _r; // position of the sources sorted such that each node is a contiguous range
+  std::vector<int> _order; // index of the sorted sources in the input order
+  std::vector<std::complex<double>> _q; // sorted charges
+  std::vector<double> _q_real, _q_imag; // real and imaginary part of the sorted charges for the direct sum kernel
+  double _theta; // opening angle of the cells
+  int _leaf_size; // maximum number of sources in leaves
+
+  // multipole moments of each node around its center: monopole, dipole, and traceless quadrupole in the order \
+     (xx, yy, zz, xy, xz, yz) with the 1/2 factor of the expansion included
+  std::vector<std::complex<double>> _monopole;
+  std::vector<std::array<std::complex<double>,3>> _dipole;
+  std::vector<std::array<std::complex<double>,6>> _quadrupole;
+
+public:
+  // build the tree over the source positions r = (x, y, z)
+  coulomb_treecode(const std::array<std::vector<double>,3>& r, const double accuracy, const int leaf_size = 32)
+  {
+    if (accuracy <= 0){
+      throw std::invalid_argument("coulomb_treecode: accuracy should be positive.");
+    }
+    _theta = std::min(std::cbrt(accuracy), 0.7);
+    _leaf_size = std::max(leaf_size, 1);
+
+    const int n = r[0].size();
+    _order.resize(n);
+    for (int i=0; i<n; i++)
+    {
+      _order[i] = i;
+    }
+
+    if (n == 0){
+      return;
+    }
+
+    // build the nodes top-down, children are always stored after their parent
+    _nodes.push_back(node_struct{0,n,{0,0,0},0});
+    for (unsigned int i_node=0; i_node<_nodes.size(); i_node++)
+    {
+      const int begin = _nodes[i_node].begin;
+      const int end = _nodes[i_node].end;
+
+      std::array<double,3> r_min, r_max;
+      for (int d=0; d<3; d++)
+      {
+        r_min[d] = r_max[d] = r[d][_order[begin]];
+        for (int i=begin+1; i<end; i++)
+        {
+          r_min[d] = std::min(r_min[d], r[d][_order[i]]);
+          r_max[d] = std::max(r_max[d], r[d][_order[i]]);
+        }
+      }
+
+      std::array<double,3> center;
+      for (int d=0; d<3; d++)
+      {
+        center[d] = 0.5*(r_min[d]+r_max[d]);
+      }
+      double radius2 = 0;
+      for (int i=begin; i<end; i++)
+      {
+        double d2 = 0;
+        for (int d=0; d<3; d++)
+        {
+          d2 += std::pow(r[d][_order[i]]-center[d],2);
+        }
+        radius2 = std::max(radius2, d2);
+      }
+      _nodes[i_node].center = center;
+      _nodes[i_node].radius = std::sqrt(radius2);
+
+      if (end-begin <= _leaf_size){
+        continue;
+      }
+
+      // split at the median along the longest side of the bounding box
+      int d_split = 0;
+      for (int d=1; d<3; d++)
+      {
+        if (r_max[d]-r_min[d] > r_max[d_split]-r_min[d_split]){
+          d_split = d;
+        }
+      }
+      const int middle = (begin+end)/2;
+      std::nth_element(_order.begin()+begin, _order.begin()+middle, _order.begin()+end, \
+                       [&](const int& a, const int& b){return r[d_split][a] < r[d_split][b];});
+
+      _nodes[i_node].children = {int(_nodes.size()), int(_nodes.size())+1};
+      _nodes.push_back(node_struct{begin,middle,{0,0,0},0});
+      _nodes.push_back(node_struct{middle,end,{0,0,0},0});
+    }
+
+    for (int d=0; d<3; d++)
+    {
+      _r[d].resize(n);
+      for (int i=0; i<n; i++)
+      {
+        _r[d][i] = r[d][_order[i]];
+      }
+    }
+  };
+
+  // opening angle that is used for the requested accuracy
+  double theta() const
+  {
+    return _theta;
+  };
+
+  // number of nodes in the tree
+  int n_nodes() const
+  {
+    return _nodes.size();
+  };
+
+  // set the charges of the sources in the input order and calculate the multipole moments of all nodes
+  void set_charges(const std::vector<std::complex<double>>& q)
+  {
+    if (q.size() != _order.size()){
+      throw std::invalid_argument("coulomb_treecode: number of charges does not match the number of sources.");
+    }
+
+    _q.resize(q.size());
+    _q_real.resize(q.size());
+    _q_imag.resize(q.size());
+    for (unsigned int i=0; i<q.size(); i++)
+    {
+      _q[i] = q[_order[i]];
+      _q_real[i] = _q[i].real();
+      _q_imag[i] = _q[i].imag();
+    }
+
+    _monopole.assign(_nodes.size(), 0);
+    _dipole.assign(_nodes.size(), {0,0,0});
+    _quadrupole.assign(_nodes.size(), {0,0,0,0,0,0});
+    for (unsigned int i_node=0; i_node<_nodes.size(); i_node++)
+    {
+      const node_struct& node = _nodes[i_node];
+      auto& m = _monopole[i_node];
+      auto& p = _dipole[i_node];
+      auto& Q = _quadrupole[i_node];
+      for (int i=node.begin; i<node.end; i++)
+      {
+        const double dx = _r[0][i]-node.center[0];
+        const double dy = _r[1][i]-node.center[1];
+        const double dz = _r[2][i]-node.center[2];
+        const double d2 = dx*dx+dy*dy+dz*dz;
+        m += _q[i];
+        p[0] += _q[i]*dx;
+        p[1] += _q[i]*dy;
+        p[2] += _q[i]*dz;
+        Q[0] += _q[i]*(0.5*(3*dx*dx-d2));
+        Q[1] += _q[i]*(0.5*(3*dy*dy-d2));
+        Q[2] += _q[i]*(0.5*(3*dz*dz-d2));
+        Q[3] += _q[i]*(1.5*dx*dy);
+        Q[4] += _q[i]*(1.5*dx*dz);
+        Q[5] += _q[i]*(1.5*dy*dz);
+      }
+    }
+  };
+
+  // coulomb potential of the charges at point (x, y, z). the point should not coincide with any of the sources.
+  std::complex<double> potential(const double& x, const double& y, const double& z) const
+  {
+    std::complex<double> phi = 0;
+    if (_nodes.empty()){
+      return phi;
+    }
+
+    std::vector<int> stack = {0};
+    stack.reserve(64);
+    while (not stack.empty())
+    {
+      const int i_node = stack.back();
+      stack.pop_back();
+      const node_struct& node = _nodes[i_node];
+
+      const double X = x-node.center[0];
+      const double Y = y-node.center[1];
+      const double Z = z-node.center[2];
+      const double rho2 = X*X+Y*Y+Z*Z;
+
+      // far-field cell
+      if (node.radius*node.radius < _theta*_theta*rho2){
+        const double inv_rho = 1./std::sqrt(rho2);
+        const double inv_rho3 = inv_rho*inv_rho*inv_rho;
+        const double inv_rho5 = inv_rho3*inv_rho*inv_rho;
+        const auto& p = _dipole[i_node];
+        const auto& Q = _quadrupole[i_node];
+        phi += _monopole[i_node]*inv_rho;
+        phi += (p[0]*X+p[1]*Y+p[2]*Z)*inv_rho3;
+        phi += (Q[0]*(X*X)+Q[1]*(Y*Y)+Q[2]*(Z*Z)+2.*(Q[3]*(X*Y)+Q[4]*(X*Z)+Q[5]*(Y*Z)))*inv_rho5;
+        continue;
+      }
+
+      // near-field leaf
+      if (node.children[0] < 0){
+        const int b = node.begin;
+        phi += coulomb_potential(x, y, z, &_r[0][b], &_r[1][b], &_r[2][b], &_q_real[b], &_q_imag[b], node.end-b);
+        continue;
+      }
+
+      stack.push_back(node.children[1]);
+      stack.push_back(node.children[0]);
+    }
+    return phi;
+  };
+};
+
+#endif //_coulomb_treecode_hpp_
@@ -2,12 +2,20 @@
 #include <string>
 #include <armadillo>
 #include <stdexcept>
+#include <algorithm>
+#include <functional>
+#include <map>
+#include <omp.h>
 #include <experimental/filesystem>
 
 #include "exciton_transfer.h"
 #include "cnt.h"
 #include "constants.h"
 #include "progress.hpp"
+#include "coulomb_kernel.h"
+#include "coulomb_treecode.hpp"
+#include "blas_threads.hpp"
+#include "sweep_checkpoint.hpp"
 
 // calculate and plot Q matrix element between two exciton bands
 void exciton_transfer::save_Q_matrix_element(const int i_n_principal, const int f_n_principal)
@@ -183,13 +191,14 @@ void exciton_transfer::save_J_matrix_element(const int i_n_principal, const int
 
   // int count = 0;
   // int number_of_pairs = state_pairs.size();
+  const auto geometry = get_geometry(axis_shifts, z_shift, theta);
   progress_bar prog(state_pairs.size(),"calculate J");
 
   for (const auto& pair:state_pairs)
   { 
     prog.step();
 
-    J_mat(pair.i.ik_cm_idx-i_min_idx, pair.f.ik_cm_idx-f_min_idx) = calculate_J(pair, axis_shifts, z_shift, theta);
+    J_mat(pair.i.ik_cm_idx-i_min_idx, pair.f.ik_cm_idx-f_min_idx) = calculate_J(pair, *geometry);
     init_ik_cm(pair.i.ik_cm_idx-i_min_idx) = pair.i.ik_cm;
     final_ik_cm(pair.f.ik_cm_idx-f_min_idx) = pair.f.ik_cm;
   }
@@ -220,10 +229,10 @@ void exciton_transfer::save_J_matrix_element(const int i_n_principal, const int
 };
 
 // get the energetically relevant states in the form a vector of ex_state structs
-std::vector<exciton_transfer::ex_state> exciton_transfer::get_relevant_states(const cnt::exciton_struct& exciton, const double min_energy)
+std::vector<exciton_transfer::ex_state> exciton_transfer::get_relevant_states(const cnt::exciton_struct& exciton, const double min_energy, \
+                                                                              const double temperature)
 {
-  const double threshold_population = 1.e-3;
-  const double threshold_energy = min_energy+std::abs(std::log(threshold_population) * constants::kb*_temperature);
+  const double threshold_energy = relevant_energy_threshold(min_energy, temperature);
 
   std::vector<ex_state> relevant_states;
   
@@ -250,7 +259,7 @@ std::vector<exciton_transfer::ex_state> exciton_transfer::get_relevant_states(co
   for (const auto& state: relevant_states)
   {
     double delta_e = (state.energy-min_energy);
-    normalization_factor += std::exp(-delta_e/(constants::kb*_temperature));
+    normalization_factor += std::exp(-delta_e/(constants::kb*temperature));
   }
 
 
@@ -266,152 +275,589 @@ std::vector<exciton_transfer::ex_state> exciton_transfer::get_relevant_states(co
   return relevant_states;
 }
 
-// calculate Q()
-std::complex<double> exciton_transfer::calculate_Q(const matching_states& pair) const
+// calculate the part of the Q matrix element that relates to each state of an exciton
+arma::cx_mat exciton_transfer::calculate_Q_partial_table(const cnt::exciton_struct& exciton) const
 {
-  // lambda function to calculate part of the Q matrix element that relates to each pair.
-  auto Q_partial = [](const ex_state& state)
-  {
-    const int ic = 1;
-    const int iv = 0;
+  const int ic = 1;
+  const int iv = 0;
+
+  const arma::vec dA = {0,0};
+  const arma::vec& dB = *(exciton.aCC_vec);
 
-    const arma::vec dA = {0,0};
-    const arma::vec& dB = *(state.exciton->aCC_vec);
-    const arma::cx_vec exp_factor({std::exp(std::complex<double>(0.,+1.)*arma::dot(state.ik_cm*state.dk_l(),dA)),\
-                                   std::exp(std::complex<double>(0.,+1.)*arma::dot(state.ik_cm*state.dk_l(),dB))});
+  arma::cx_mat Q_partial(exciton.nk_cm, exciton.n_principal);
+  arma::cx_vec overlap(exciton.nk_c);
+  for (int ik_cm_idx=0; ik_cm_idx<exciton.nk_cm; ik_cm_idx++)
+  {
+    const int ik_cm = ik_cm_idx+exciton.ik_cm_range[0];
+    const arma::cx_vec exp_factor({std::exp(std::complex<double>(0.,+1.)*arma::dot(ik_cm*(*exciton.dk_l),dA)),\
+                                   std::exp(std::complex<double>(0.,+1.)*arma::dot(ik_cm*(*exciton.dk_l),dB))});
 
-    std::complex<double> Q_partial = 0;
-    for (int ik_c_idx=0; ik_c_idx<state.exciton->nk_c; ik_c_idx++)
+    // overlap of the conduction and valence band wavefunctions is shared by all principal states with this ik_cm
+    for (int ik_c_idx=0; ik_c_idx<exciton.nk_c; ik_c_idx++)
     {
-      const arma::cx_vec& Cc = state.elec_struct->wavefunc(state.ik_idx(1,ik_c_idx)).slice(state.ik_idx(0,ik_c_idx)).col(ic);
-      const arma::cx_vec& Cv = state.elec_struct->wavefunc(state.ik_idx(3,ik_c_idx)).slice(state.ik_idx(2,ik_c_idx)).col(iv);
-      Q_partial += state.psi(ik_c_idx)*arma::accu(Cc%arma::conj(Cv)%exp_factor);
+      const arma::cx_vec& Cc = exciton.elec_struct->wavefunc(exciton.ik_idx(1,ik_c_idx,ik_cm_idx)).slice(exciton.ik_idx(0,ik_c_idx,ik_cm_idx)).col(ic);
+      const arma::cx_vec& Cv = exciton.elec_struct->wavefunc(exciton.ik_idx(3,ik_c_idx,ik_cm_idx)).slice(exciton.ik_idx(2,ik_c_idx,ik_cm_idx)).col(iv);
+      overlap(ik_c_idx) = arma::accu(Cc%arma::conj(Cv)%exp_factor);
     }
 
-    return Q_partial;
+    Q_partial.row(ik_cm_idx) = overlap.st()*exciton.psi.slice(ik_cm_idx);
+  }
 
-  };
+  return Q_partial;
+};
+
+// calculate Q()
+std::complex<double> exciton_transfer::calculate_Q(const matching_states& pair) const
+{
+  const std::complex<double> i_Q_partial = get_Q_partial_table(*pair.i.exciton)(pair.i.ik_cm_idx, pair.i.i_principal);
+  const std::complex<double> f_Q_partial = get_Q_partial_table(*pair.f.exciton)(pair.f.ik_cm_idx, pair.f.i_principal);
 
   double coeff = (std::pow(constants::q0,2)*pair.i.cnt_obj->Au()*pair.f.cnt_obj->Au())/\
                  (16*std::pow(constants::pi,3)*constants::eps0*pair.i.cnt_obj->radius()*pair.f.cnt_obj->radius()*\
                   std::sqrt(pair.i.cnt_obj->length_in_meter()*pair.f.cnt_obj->length_in_meter()));
 
-  return std::complex<double>(coeff)*std::conj(Q_partial(pair.i))*Q_partial(pair.f);
+  return std::complex<double>(coeff)*std::conj(i_Q_partial)*f_Q_partial;
 
 };
 
-// calculate J()
-std::complex<double> exciton_transfer::calculate_J(const matching_states& pair, const std::array<double,2>& shifts_along_axis, const double& z_shift, const double& angle) const
+// build the geometry of the donor and acceptor cnts for the given shifts and angle
+std::shared_ptr<const exciton_transfer::geometry_struct> exciton_transfer::make_geometry(const std::array<double,2>& shifts_along_axis, \
+                                                                                      const double& z_shift, const double& angle) const
 {
-  // make position of all atoms in the entire cnt length in 3d space
-  auto make_Ru_3d = [](const cnt& m_cnt, const double shift_along_axis, const double z_shift, const double angle) {
-    int n_atoms_in_cnt_unit_cell = m_cnt.pos_u_3d().n_rows;
-    int total_number_of_atoms = m_cnt.pos_u_3d().n_rows * m_cnt.length_in_cnt_unit_cell();
-    arma::mat all_atoms(total_number_of_atoms,3);
+  auto geometry = std::make_shared<geometry_struct>();
+  geometry->shifts_along_axis = shifts_along_axis;
+  geometry->z_shift = z_shift;
+  geometry->angle = angle;
+
+  // the donor cnt is only shifted along its axis, the acceptor cnt is also shifted along the z axis and rotated
+  const std::array<double,2> z_shifts = {0, z_shift};
+  const std::array<double,2> angles = {0, angle};
+
+  for (int i_cnt=0; i_cnt<2; i_cnt++)
+  {
+    const cnt& m_cnt = *_cnts[i_cnt];
+    const int n_atoms_in_cnt_unit_cell = m_cnt.pos_u_3d().n_rows;
+    const int total_number_of_atoms = n_atoms_in_cnt_unit_cell * m_cnt.length_in_cnt_unit_cell();
+    geometry->n_atoms_in_cell[i_cnt] = n_atoms_in_cnt_unit_cell;
 
+    auto& Ru_3d = geometry->Ru_3d[i_cnt];
+    auto& Ru_2d = geometry->Ru_2d[i_cnt];
+    for (auto& r: Ru_3d) r.resize(total_number_of_atoms);
+    for (auto& r: Ru_2d) r.resize(total_number_of_atoms);
+
+    // make position of all atoms in the entire cnt length in 3d space and in 2d space of unrolled cnt
     for (int i=0; i<m_cnt.length_in_cnt_unit_cell(); i++)
     {
-      all_atoms.rows(i*n_atoms_in_cnt_unit_cell,(i+1)*n_atoms_in_cnt_unit_cell-1) = i*m_cnt.pos_u_3d();
+      for (int i_atom=0; i_atom<n_atoms_in_cnt_unit_cell; i_atom++)
+      {
+        const int idx = i*n_atoms_in_cnt_unit_cell+i_atom;
+        for (int i_dim=0; i_dim<3; i_dim++)
+        {
+          Ru_3d[i_dim][idx] = i*m_cnt.pos_u_3d()(i_atom,i_dim);
+        }
+        for (int i_dim=0; i_dim<2; i_dim++)
+        {
+          Ru_2d[i_dim][idx] = i*m_cnt.pos_u_2d()(i_atom,i_dim);
+        }
+      }
     }
 
-    // make the cnt center at the middle
-    double y_max = all_atoms.col(1).max();
-    double y_min = all_atoms.col(1).min();
-    all_atoms.col(1) -= ((y_max+y_min)/2.);
-
-    // shift the center of the cnt axis along it's axis
-    all_atoms.col(1) += shift_along_axis;
+    // make the cnt center at the middle and shift the center of the cnt axis along it's axis
+    const auto y_minmax = std::minmax_element(Ru_3d[1].begin(), Ru_3d[1].end());
+    const double y_center = (*y_minmax.second + *y_minmax.first)/2.;
+    for (auto& y: Ru_3d[1])
+    {
+      y += shifts_along_axis[i_cnt] - y_center;
+    }
 
     // shift the atoms along the z axis
-    all_atoms.col(2) +=  z_shift;
+    for (auto& z: Ru_3d[2])
+    {
+      z += z_shifts[i_cnt];
+    }
 
     // rotate by angle around the z axis
-    for (unsigned int i=0; i<all_atoms.n_rows; i++)
+    const double cos_angle = std::cos(angles[i_cnt]);
+    const double sin_angle = std::sin(angles[i_cnt]);
+    for (int idx=0; idx<total_number_of_atoms; idx++)
     {
-      double x = all_atoms(i,0)*std::cos(angle) - all_atoms(i,1)*std::sin(angle);
-      double y = all_atoms(i,0)*std::sin(angle) + all_atoms(i,1)*std::cos(angle);
-      all_atoms(i,0) = x;
-      all_atoms(i,1) = y;
+      const double x = Ru_3d[0][idx]*cos_angle - Ru_3d[1][idx]*sin_angle;
+      const double y = Ru_3d[0][idx]*sin_angle + Ru_3d[1][idx]*cos_angle;
+      Ru_3d[0][idx] = x;
+      Ru_3d[1][idx] = y;
     }
-    return all_atoms;
-  };
+  }
 
-    // make position of all atoms in the entire cnt length in 2d space of unrolled cnt
-  auto make_Ru_2d = [](const cnt& m_cnt) {
-    int n_atoms_in_cnt_unit_cell = m_cnt.pos_u_2d().n_rows;
-    int total_number_of_atoms = m_cnt.pos_u_2d().n_rows * m_cnt.length_in_cnt_unit_cell();
-    arma::mat all_atoms(total_number_of_atoms,2);
+  return geometry;
+};
 
-    for (int i=0; i<m_cnt.length_in_cnt_unit_cell(); i++)
+// calculate J() for a geometry that is already built
+std::complex<double> exciton_transfer::calculate_J(const matching_states& pair, const geometry_struct& geometry) const
+{
+  const auto& i_Ru_3d = geometry.Ru_3d[0];
+  const auto& f_Ru_3d = geometry.Ru_3d[1];
+  const auto& i_Ru_2d = geometry.Ru_2d[0];
+  const auto& f_Ru_2d = geometry.Ru_2d[1];
+  const int n_i = i_Ru_3d[0].size();
+  const int n_f = f_Ru_3d[0].size();
+
+  std::complex<double> J = 0;
+  const std::complex<double> i1(0,1);
+
+  const arma::vec i_k = pair.i.ik_cm*pair.i.dk_l();
+  const arma::vec f_k = pair.f.ik_cm*pair.f.dk_l();
+
+  // prebuild exponential factor for the inner loop with separate real and imaginary parts for the vectorized kernel
+  std::vector<double> f_exp_real(n_f), f_exp_imag(n_f);
+  for (int j=0; j<n_f; j++)
+  {
+    const std::complex<double> f_exp = std::exp(+i1*(f_k(0)*f_Ru_2d[0][j]+f_k(1)*f_Ru_2d[1][j]));
+    f_exp_real[j] = f_exp.real();
+    f_exp_imag[j] = f_exp.imag();
+  }
+
+  for (int i=0; i<n_i; i++)
+  {
+    const std::complex<double> i_exp = std::exp(-i1*(i_k(0)*i_Ru_2d[0][i]+i_k(1)*i_Ru_2d[1][i]));
+    J += i_exp*coulomb_potential(i_Ru_3d[0][i], i_Ru_3d[1][i], i_Ru_3d[2][i], f_Ru_3d[0].data(), f_Ru_3d[1].data(), \
+                                 f_Ru_3d[2].data(), f_exp_real.data(), f_exp_imag.data(), n_f);
+  }
+  return J;
+};
+
+// phase matrix E(atom,ik_cm) = exp(+i*k_cm.R_2d) of the atoms of a cnt for a list of center of mass momenta
+arma::cx_mat exciton_transfer::make_phase_matrix(const int& i_cnt, const std::vector<int>& ik_cm, const geometry_struct& geometry) const
+{
+  const auto& Ru_2d = geometry.Ru_2d[i_cnt];
+  const arma::vec& dk_l = *(_cnts[i_cnt]->A2_singlet().dk_l);
+  arma::cx_mat E(Ru_2d[0].size(), ik_cm.size());
+  for (unsigned int ik_idx=0; ik_idx<ik_cm.size(); ik_idx++)
+  {
+    const arma::vec k = ik_cm[ik_idx]*dk_l;
+    for (unsigned int i=0; i<Ru_2d[0].size(); i++)
     {
-      all_atoms.rows(i*n_atoms_in_cnt_unit_cell,(i+1)*n_atoms_in_cnt_unit_cell-1) = i*m_cnt.pos_u_2d();
+      E(i,ik_idx) = std::exp(std::complex<double>(0,1)*(k(0)*Ru_2d[0][i]+k(1)*Ru_2d[1][i]));
     }
+  }
+  return E;
+};
 
-    return all_atoms;
-  };
+// calculate J() for all combinations of the given initial and final center of mass momenta at once. the states only enter \
+   J through the plane wave phases, so with the phase matrices E(atom,ik_cm) = exp(+i*k_cm.R_2d) of each cnt and the \
+   coulomb kernel G(i,j) = 1/|R_i-R_j| we get J = E_i^H*G*E_f. G is never stored as a whole: it is built for tiles of \
+   donor and acceptor atoms and multiplied into the phase matrices with matrix-matrix products.
+arma::cx_mat exciton_transfer::calculate_J_batched(const std::vector<int>& i_ik_cm, const std::vector<int>& f_ik_cm, \
+                                                   const geometry_struct& geometry) const
+{
+  const auto& i_Ru_3d = geometry.Ru_3d[0];
+  const auto& f_Ru_3d = geometry.Ru_3d[1];
+  const int n_i = i_Ru_3d[0].size();
+  const int n_f = f_Ru_3d[0].size();
+  const int nk_i = i_ik_cm.size();
+  const int nk_f = f_ik_cm.size();
+
+  // phase matrices of each cnt in the format (atom, ik_cm)
+  const arma::cx_mat E_i = make_phase_matrix(0, i_ik_cm, geometry);
+  const arma::cx_mat E_f = make_phase_matrix(1, f_ik_cm, geometry);
+  // the coulomb kernel is built in tiles of block_size donor atoms times tile_size acceptor atoms, so the memory of each \
+     thread does not grow with the length of the cnts
+  const int block_size = 256;
+  const int tile_size = 2048;
+  const int n_blocks = (n_i+block_size-1)/block_size;
+  const int n_tiles = (n_f+tile_size-1)/tile_size;
+
+  // real and imaginary part of the acceptor phases split into contiguous tiles of acceptor atoms
+  std::vector<arma::mat> E_f_real(n_tiles), E_f_imag(n_tiles);
+  for (int i_tile=0; i_tile<n_tiles; i_tile++)
+  {
+    const int j_begin = i_tile*tile_size;
+    const int j_end = std::min(j_begin+tile_size, n_f);
+    E_f_real[i_tile] = arma::real(E_f.rows(j_begin,j_end-1));
+    E_f_imag[i_tile] = arma::imag(E_f.rows(j_begin,j_end-1));
+  }
+
+  // each thread sums over a fixed set of blocks so that the result only depends on the number of threads
+  std::vector<arma::cx_mat> J_partial;
+  single_threaded_blas blas_threads;
+  #pragma omp parallel
+  {
+    #pragma omp single
+    J_partial.resize(omp_get_num_threads());
 
-  arma::mat i_Ru_3d = make_Ru_3d(*(pair.i.cnt_obj), shifts_along_axis[0], 0, 0);
-  arma::mat f_Ru_3d = make_Ru_3d(*(pair.f.cnt_obj), shifts_along_axis[1], z_shift, angle);
+    arma::cx_mat& J_thread = J_partial[omp_get_thread_num()];
+    J_thread.zeros(nk_i,nk_f);
+    std::vector<double> G_memory(block_size*tile_size);
+    arma::mat GE_f_real(block_size,nk_f), GE_f_imag(block_size,nk_f);
 
-  arma::mat i_Ru_2d = make_Ru_2d(*(pair.i.cnt_obj));
-  arma::mat f_Ru_2d = make_Ru_2d(*(pair.f.cnt_obj));
+    #pragma omp for schedule(static)
+    for (int i_block=0; i_block<n_blocks; i_block++)
+    {
+      const int i_begin = i_block*block_size;
+      const int i_end = std::min(i_begin+block_size, n_i);
+      const int n_rows = i_end-i_begin;
 
-  std::complex<double> J = 0;
-  const std::complex<double> i1(0,1);
+      GE_f_real.zeros(n_rows,nk_f);
+      GE_f_imag.zeros(n_rows,nk_f);
+      for (int i_tile=0; i_tile<n_tiles; i_tile++)
+      {
+        const int j_begin = i_tile*tile_size;
+        const int j_end = std::min(j_begin+tile_size, n_f);
+
+        // coulomb kernel for the tile, stored contiguously in the memory of the thread
+        arma::mat G(G_memory.data(), n_rows, j_end-j_begin, false, true);
+        for (int j=j_begin; j<j_end; j++)
+        {
+          const double xj = f_Ru_3d[0][j];
+          const double yj = f_Ru_3d[1][j];
+          const double zj = f_Ru_3d[2][j];
+          #pragma omp simd
+          for (int i=i_begin; i<i_end; i++)
+          {
+            const double dx = i_Ru_3d[0][i]-xj;
+            const double dy = i_Ru_3d[1][i]-yj;
+            const double dz = i_Ru_3d[2][i]-zj;
+            G(i-i_begin,j-j_begin) = 1./std::sqrt(dx*dx+dy*dy+dz*dz);
+          }
+        }
+
+        GE_f_real += G*E_f_real[i_tile];
+        GE_f_imag += G*E_f_imag[i_tile];
+      }
+
+      J_thread += E_i.rows(i_begin,i_end-1).t()*arma::cx_mat(GE_f_real,GE_f_imag);
+    }
+  }
+  blas_threads.restore();
 
-  // prebuild exponential factor for the inner loop
-  arma::cx_vec f_exp(f_Ru_2d.n_rows);
-  for (unsigned int j=0; j<f_Ru_2d.n_rows; j++)
+  arma::cx_mat J(nk_i,nk_f,arma::fill::zeros);
+  for (const auto& J_thread: J_partial)
   {
-    f_exp(j) = std::exp(+i1*arma::dot(pair.f.ik_cm*pair.f.dk_l(),f_Ru_2d.row(j)));
+    J += J_thread;
   }
+  return J;
+};
 
-  for (unsigned int i=0; i<i_Ru_2d.n_rows; i++)
+// calculate J() for all combinations of the given initial and final center of mass momenta with a treecode over the \
+   acceptor atoms, where the error of the coulomb potential is controlled by _J_accuracy
+arma::cx_mat exciton_transfer::calculate_J_treecode(const std::vector<int>& i_ik_cm, const std::vector<int>& f_ik_cm, \
+                                                    const geometry_struct& geometry) const
+{
+  const auto& i_Ru_3d = geometry.Ru_3d[0];
+  const int n_i = i_Ru_3d[0].size();
+  const int nk_f = f_ik_cm.size();
+
+  const arma::cx_mat E_i = make_phase_matrix(0, i_ik_cm, geometry);
+  const arma::cx_mat E_f = make_phase_matrix(1, f_ik_cm, geometry);
+
+  // the tree only depends on the position of the acceptor atoms, the phases of each final momentum are the charges of the \
+     sources. the potential of these charges at each donor atom is shared by all initial momenta.
+  coulomb_treecode tree(geometry.Ru_3d[1], _J_accuracy);
+  arma::cx_mat J(i_ik_cm.size(),nk_f);
+  arma::cx_vec phi(n_i);
+  for (int f_idx=0; f_idx<nk_f; f_idx++)
   {
-    std::complex<double> i_exp = std::exp(-i1*arma::dot(pair.i.ik_cm*pair.i.dk_l(),i_Ru_2d.row(i)));    
-    for (unsigned int j=0; j<f_Ru_2d.n_rows; j++)
+    tree.set_charges(std::vector<std::complex<double>>(E_f.colptr(f_idx), E_f.colptr(f_idx)+E_f.n_rows));
+    #pragma omp parallel for schedule(dynamic,64)
+    for (int i=0; i<n_i; i++)
     {
-      J += i_exp*f_exp(j)/(arma::norm(i_Ru_3d.row(i)-f_Ru_3d.row(j)));
+      phi(i) = tree.potential(i_Ru_3d[0][i], i_Ru_3d[1][i], i_Ru_3d[2][i]);
     }
+    J.col(f_idx) = E_i.t()*phi;
+  }
+  return J;
+};
+
+arma::cx_mat exciton_transfer::calculate_J_multipole(const std::vector<int>& i_ik_cm, const std::vector<int>& f_ik_cm, \
+                                                     const geometry_struct& geometry, double& error_estimate) const
+{
+  const auto& i_Ru_3d = geometry.Ru_3d[0];
+  const auto& f_Ru_3d = geometry.Ru_3d[1];
+  const int n_i = i_Ru_3d[0].size();
+  const int nk_f = f_ik_cm.size();
+
+  const arma::cx_mat E_i = make_phase_matrix(0, i_ik_cm, geometry);
+  const arma::cx_mat E_f = make_phase_matrix(1, f_ik_cm, geometry);
+
+  // center of the bounding box and the distance of the farthest atom from it for each cnt unit cell
+  struct cells_struct
+  {
+    int n_cells;
+    int n_atoms; // number of atoms in each unit cell
+    std::array<std::vector<double>,3> center;
+    std::vector<double> radius;
+  };
+  auto make_cells = [&](const int i_cnt){
+    const auto& Ru_3d = geometry.Ru_3d[i_cnt];
+    cells_struct cells;
+    cells.n_atoms = geometry.n_atoms_in_cell[i_cnt];
+    cells.n_cells = Ru_3d[0].size()/cells.n_atoms;
+    cells.radius.assign(cells.n_cells, 0);
+    for (auto& c: cells.center) c.resize(cells.n_cells);
+    for (int c=0; c<cells.n_cells; c++)
+    {
+      const int begin = c*cells.n_atoms;
+      const int end = begin+cells.n_atoms;
+      for (int d=0; d<3; d++)
+      {
+        const auto minmax = std::minmax_element(Ru_3d[d].begin()+begin, Ru_3d[d].begin()+end);
+        cells.center[d][c] = (*minmax.first + *minmax.second)/2.;
+      }
+      for (int a=begin; a<end; a++)
+      {
+        double d2 = 0;
+        for (int d=0; d<3; d++)
+        {
+          d2 += std::pow(Ru_3d[d][a]-cells.center[d][c],2);
+        }
+        cells.radius[c] = std::max(cells.radius[c], std::sqrt(d2));
+      }
+    }
+    return cells;
+  };
+  const cells_struct i_cells = make_cells(0);
+  const cells_struct f_cells = make_cells(1);
+
+  // pairs of unit cells that are close to each other are summed exactly. the expansion is also only used when the cells \
+     are far apart compared to their size so that the neglected terms are small.
+  std::vector<std::vector<int>> near_cells(i_cells.n_cells);
+  std::vector<std::vector<int>> far_cells(i_cells.n_cells);
+  error_estimate = 0;
+  for (int c=0; c<i_cells.n_cells; c++)
+  {
+    for (int c_f=0; c_f<f_cells.n_cells; c_f++)
+    {
+      double R2 = 0;
+      for (int d=0; d<3; d++)
+      {
+        R2 += std::pow(i_cells.center[d][c]-f_cells.center[d][c_f],2);
+      }
+      const double R = std::sqrt(R2);
+      const double s = i_cells.radius[c]+f_cells.radius[c_f];
+      if ((R > _J_multipole_cutoff) and (R > 2*s)){
+        far_cells[c].push_back(c_f);
+        // remainder of the first order taylor expansion of 1/|R+d_i-d_f| with |d_i-d_f| <= s for unit phase factors
+        error_estimate += double(i_cells.n_atoms)*double(f_cells.n_atoms)*s*s/std::pow(R-s,3);
+      } else {
+        near_cells[c].push_back(c_f);
+      }
+    }
+  }
+
+  arma::cx_mat J(i_ik_cm.size(),nk_f);
+  arma::cx_vec phi(n_i);
+  std::vector<double> f_exp_real(f_Ru_3d[0].size()), f_exp_imag(f_Ru_3d[0].size());
+  std::vector<std::complex<double>> monopole(f_cells.n_cells);
+  std::vector<std::array<std::complex<double>,3>> dipole(f_cells.n_cells);
+  for (int f_idx=0; f_idx<nk_f; f_idx++)
+  {
+    for (unsigned int j=0; j<f_exp_real.size(); j++)
+    {
+      f_exp_real[j] = E_f(j,f_idx).real();
+      f_exp_imag[j] = E_f(j,f_idx).imag();
+    }
+
+    // monopole and dipole moments of the acceptor unit cells around their centers
+    for (int c_f=0; c_f<f_cells.n_cells; c_f++)
+    {
+      monopole[c_f] = 0;
+      dipole[c_f] = {0,0,0};
+      for (int a=c_f*f_cells.n_atoms; a<(c_f+1)*f_cells.n_atoms; a++)
+      {
+        monopole[c_f] += E_f(a,f_idx);
+        for (int d=0; d<3; d++)
+        {
+          dipole[c_f][d] += E_f(a,f_idx)*(f_Ru_3d[d][a]-f_cells.center[d][c_f]);
+        }
+      }
+    }
+
+    // potential at each donor atom. the far-field potential of a donor unit cell is expanded to first order around its \
+       center: A + B.d where d is the position of the atom relative to the center.
+    #pragma omp parallel for schedule(dynamic)
+    for (int c=0; c<i_cells.n_cells; c++)
+    {
+      std::complex<double> A = 0;
+      std::array<std::complex<double>,3> B = {0,0,0};
+      for (const int& c_f: far_cells[c])
+      {
+        std::array<double,3> R;
+        for (int d=0; d<3; d++)
+        {
+          R[d] = i_cells.center[d][c]-f_cells.center[d][c_f];
+        }
+        const double inv_R = 1./std::sqrt(R[0]*R[0]+R[1]*R[1]+R[2]*R[2]);
+        const double inv_R3 = inv_R*inv_R*inv_R;
+        A += monopole[c_f]*inv_R + (dipole[c_f][0]*R[0]+dipole[c_f][1]*R[1]+dipole[c_f][2]*R[2])*inv_R3;
+        for (int d=0; d<3; d++)
+        {
+          B[d] -= monopole[c_f]*(R[d]*inv_R3);
+        }
+      }
+
+      for (int a=c*i_cells.n_atoms; a<(c+1)*i_cells.n_atoms; a++)
+      {
+        phi(a) = A;
+        for (int d=0; d<3; d++)
+        {
+          phi(a) += B[d]*(i_Ru_3d[d][a]-i_cells.center[d][c]);
+        }
+        for (const int& c_f: near_cells[c])
+        {
+          const int b = c_f*f_cells.n_atoms;
+          phi(a) += coulomb_potential(i_Ru_3d[0][a], i_Ru_3d[1][a], i_Ru_3d[2][a], &f_Ru_3d[0][b], &f_Ru_3d[1][b], &f_Ru_3d[2][b], \
+                                      &f_exp_real[b], &f_exp_imag[b], f_cells.n_atoms);
+        }
+      }
+    }
+    J.col(f_idx) = E_i.t()*phi;
   }
   return J;
 };
 
 // calculate first order transfer rate
-double exciton_transfer::first_order(const double& z_shift, const std::array<double,2> axis_shifts, const double& theta, const bool& show_results)
+std::shared_ptr<const exciton_transfer::transfer_plan_struct> exciton_transfer::make_transfer_plan()
 {
+  auto plan = std::make_shared<transfer_plan_struct>();
+
   const cnt& donor = *_cnts[0];
   const cnt& acceptor = *_cnts[1];
 
-  double min_energy = donor.A2_singlet().energy.min();
+  // the states and pairs are found for the highest temperature and the widest broadening, which include the states and \
+     pairs of all other conditions. the states and pairs that are not relevant for a condition get zero weight in it.
+  const double max_temperature = *std::max_element(_temperatures.begin(), _temperatures.end());
+  const double max_broadening_factor = *std::max_element(_broadening_factors.begin(), _broadening_factors.end());
 
-  const cnt::exciton_struct& d_exciton = donor.A2_singlet();
-  const cnt::exciton_struct& a_exciton = acceptor.A2_singlet();
+  // pairs of states of all channels are kept in one list so that they share the J values of each geometry, pairs of a \
+     channel only have weight in the conditions of that channel.
+  std::vector<double> min_energy(_channels.size());
+  std::vector<std::array<unsigned int,2>> pair_range(_channels.size());
+  for (unsigned int i_channel=0; i_channel<_channels.size(); i_channel++)
+  {
+    const cnt::exciton_struct& d_exciton = channel_exciton(donor, _channels[i_channel][0]);
+    const cnt::exciton_struct& a_exciton = channel_exciton(acceptor, _channels[i_channel][1]);
 
-  // find lists of relevant states in donor and acceptor excitons
-  std::vector<ex_state> d_relevant_states = get_relevant_states(d_exciton,min_energy);
-  std::vector<ex_state> a_relevant_states = get_relevant_states(a_exciton,min_energy);
+    min_energy[i_channel] = d_exciton.energy.min();
+
+    // find lists of relevant states in donor and acceptor excitons
+    std::vector<ex_state> d_relevant_states = get_relevant_states(d_exciton,min_energy[i_channel],max_temperature);
+    std::vector<ex_state> a_relevant_states = get_relevant_states(a_exciton,min_energy[i_channel],max_temperature);
+
+    // match the states based on their energy
+    std::vector<matching_states> channel_pairs = match_states(d_relevant_states, a_relevant_states, max_broadening_factor);
+    pair_range[i_channel] = {unsigned(plan->state_pairs.size()), unsigned(plan->state_pairs.size()+channel_pairs.size())};
+    for (const auto& pair: channel_pairs)
+    {
+      plan->state_pairs.emplace_back(pair);
+    }
+  }
+
+  const int n_conditions_per_channel = _temperatures.size()*_broadening_factors.size();
+  const int n_conditions = _channels.size()*n_conditions_per_channel;
+  plan->conditions.set_size(n_conditions,3);
+  plan->weight.zeros(plan->state_pairs.size(),n_conditions);
+  for (unsigned int i_channel=0; i_channel<_channels.size(); i_channel++)
+  {
+    const cnt::exciton_struct& d_exciton = channel_exciton(donor, _channels[i_channel][0]);
+    const std::vector<ex_state> d_relevant_states = get_relevant_states(d_exciton,min_energy[i_channel],max_temperature);
+
+    for (unsigned int i_broadening=0; i_broadening<_broadening_factors.size(); i_broadening++)
+    {
+      for (unsigned int i_temperature=0; i_temperature<_temperatures.size(); i_temperature++)
+      {
+        const int i_condition = i_channel*n_conditions_per_channel+i_broadening*_temperatures.size()+i_temperature;
+        const double temperature = _temperatures[i_temperature];
+        const double broadening_factor = _broadening_factors[i_broadening];
+        plan->conditions(i_condition,0) = temperature;
+        plan->conditions(i_condition,1) = broadening_factor*1.e3/constants::eV;
+        plan->conditions(i_condition,2) = i_channel;
+
+        const double threshold_energy = relevant_energy_threshold(min_energy[i_channel], temperature);
+        double Z = 0;
+        for (const auto& state:d_relevant_states)
+        {
+          if (state.energy <= threshold_energy){
+            Z += std::exp(-state.energy/(constants::kb*temperature));
+          }
+        }
+
+        for (unsigned int i_pair=pair_range[i_channel][0]; i_pair<pair_range[i_channel][1]; i_pair++)
+        {
+          const auto& pair = plan->state_pairs[i_pair];
+          if ((pair.i.energy > threshold_energy) or (pair.f.energy > threshold_energy) or (not is_matched(pair.i, pair.f, broadening_factor))){
+            continue;
+          }
+          const double Q2 = std::norm(calculate_Q(pair))/(pair.i.cnt_obj->length_in_meter()*pair.f.cnt_obj->length_in_meter());
+          plan->weight(i_pair,i_condition) = (2*constants::pi/constants::hb)*(std::exp(-pair.i.energy/(constants::kb*temperature))/Z)*Q2* \
+                                             lorentzian(pair.i.energy-pair.f.energy, broadening_factor);
+        }
+      }
+    }
+  }
 
-  double Z = 0;
-  for (const auto& state:d_relevant_states)
+  for (const auto& pair:plan->state_pairs)
   {
-    Z += std::exp(-state.energy/(constants::kb*_temperature));
+    plan->ik_cm_list[0].push_back(pair.i.ik_cm);
+    plan->ik_cm_list[1].push_back(pair.f.ik_cm);
   }
 
-  // match the states based on their energy
-  std::vector<matching_states> state_pairs = match_states(d_relevant_states, a_relevant_states);
+  for (auto& list: plan->ik_cm_list)
+  {
+    std::sort(list.begin(), list.end());
+    list.erase(std::unique(list.begin(), list.end()), list.end());
+  }
 
+  return plan;
+};
 
-  double transfer_rate = 0;
+arma::vec exciton_transfer::first_order_all_conditions(const double& z_shift, const std::array<double,2> axis_shifts, const double& theta, \
+                                                       const bool& show_results)
+{
+  // states, populations, and Q do not depend on the geometry and are taken from the plan
+  const auto plan = get_transfer_plan();
+  const auto& state_pairs = plan->state_pairs;
+  const auto& ik_cm_list = plan->ik_cm_list;
+
+  arma::vec transfer_rate(plan->conditions.n_rows, arma::fill::zeros);
+
+  // all pairs of states share the positions of atoms at this geometry
+  const auto geometry = get_geometry(axis_shifts, z_shift, theta);
+
+  // J is shared between pairs of states with the same center of mass momenta through a memo table. in the batched, treecode, \
+     and multipole modes the table is filled for all pairs of center of mass momenta of the matched states at once.
+  J_memo_struct J_memo;
+  double J_error_estimate = 0;
+  if (_J_method != J_direct)
+  {
+    arma::cx_mat J_all_momenta;
+    if (_J_method == J_batched){
+      J_all_momenta = calculate_J_batched(ik_cm_list[0], ik_cm_list[1], *geometry);
+    } else if (_J_method == J_treecode){
+      J_all_momenta = calculate_J_treecode(ik_cm_list[0], ik_cm_list[1], *geometry);
+    } else {
+      J_all_momenta = calculate_J_multipole(ik_cm_list[0], ik_cm_list[1], *geometry, J_error_estimate);
+      // report the error bound relative to the largest J at this geometry
+      if (J_all_momenta.n_elem > 0){
+        J_error_estimate /= arma::abs(J_all_momenta).max();
+      }
+      double old_estimate = _J_max_error_estimate.load();
+      while ((J_error_estimate > old_estimate) and (not _J_max_error_estimate.compare_exchange_weak(old_estimate, J_error_estimate)));
+    }
+    for (unsigned int i_idx=0; i_idx<ik_cm_list[0].size(); i_idx++)
+    {
+      for (unsigned int f_idx=0; f_idx<ik_cm_list[1].size(); f_idx++)
+      {
+        J_memo.insert(ik_cm_list[0][i_idx], ik_cm_list[1][f_idx], J_all_momenta(i_idx,f_idx));
+      }
+    }
+  }
 
   progress_bar prog(state_pairs.size(),"calculate first-order exciton transfer rate", not show_results);
-  for (const auto& pair:state_pairs)
+  for (unsigned int i_pair=0; i_pair<state_pairs.size(); i_pair++)
   { 
     prog.step();
-    std::complex<double> Q = calculate_Q(pair);
-    std::complex<double> J = calculate_J(pair, axis_shifts, z_shift, theta);
-    double M = std::abs(Q*J)/std::sqrt(pair.i.cnt_obj->length_in_meter()*pair.f.cnt_obj->length_in_meter());
-    transfer_rate += (2*constants::pi/constants::hb)*(std::exp(-pair.i.energy/(constants::kb*_temperature))/Z)*std::pow(M,2)*lorentzian(pair.i.energy-pair.f.energy);
+    const auto& pair = state_pairs[i_pair];
+    std::complex<double> J = J_memo.get(pair.i.ik_cm, pair.f.ik_cm, [&](){return calculate_J(pair, *geometry);});
+    transfer_rate += plan->weight.row(i_pair).t()*std::norm(J);
   }
 
   if (show_results)
@@ -423,135 +869,340 @@ double exciton_transfer::first_order(const double& z_shift, const std::array<dou
     std::cout << "wall to wall distance: " << (z_shift - _cnts[0]->radius() - _cnts[1]->radius())*1.e9 << " [nm]\n";
     std::cout << "theta: " << theta/constants::pi*180 << " [degrees]\n";
     std::cout << "axis shifts: " << axis_shifts[0]*1e9 << " [nm] and " << axis_shifts[1]*1e9 << " [nm]\n";
-    std::cout << "exciton transfer rate: " << transfer_rate << "\n";
+    std::cout << "exciton transfer rate: " << transfer_rate(0) << "\n";
+    for (unsigned int i=1; i<transfer_rate.n_elem; i++)
+    {
+      const auto& channel = _channels[int(plan->conditions(i,2))];
+      std::cout << "exciton transfer rate of " << channel[0] << " -> " << channel[1] << " at " << plan->conditions(i,0) << " [Kelvin] and " \
+                << plan->conditions(i,1) << " [meV]: " << transfer_rate(i) << "\n";
+    }
+    std::cout << "J memo table: " << J_memo.hits << " hits, " << J_memo.misses << " misses, " << J_memo.precomputed \
+              << " values precomputed by the batch\n";
+    if (_J_method == J_multipole){
+      std::cout << "J multipole error estimate: " << J_error_estimate << " relative to max |J|\n";
+    }
   }
 
+  _J_memo_hits += J_memo.hits;
+  _J_memo_misses += J_memo.misses;
+  _J_memo_precomputed += J_memo.precomputed;
+
   return transfer_rate;
 };
 
-// calculate first order transfer rate for varying angle
-void exciton_transfer::calculate_first_order_vs_angle(const arma::vec& angle_vec ,const double& z_shift, const std::array<double,2> axis_shifts)
+// calculate first order transfer rate at all points of a sweep in parallel
+arma::mat exciton_transfer::first_order_sweep(const std::vector<sweep_point_struct>& points, const std::string& title, \
+                                              const std::string& name)
 {
-  int n_theta = angle_vec.n_elem;
-  arma::vec transfer_rate(arma::size(angle_vec), arma::fill::zeros);
+  // make the plan before the threads start so that all points share it
+  const int n_conditions = get_transfer_plan()->conditions.n_rows;
+
+  const int n = points.size();
+  arma::mat transfer_rate(n, n_conditions, arma::fill::zeros);
+
+  // each finished point is appended to the checkpoint file as (z_shift, axis shift 1, axis shift 2, angle, transfer rate \
+     of each condition). the conditions are the signature of the file, so a previous run with other temperatures, \
+     broadening factors, or channels is not resumed. in the resume mode the points of a previous run with the same \
+     index and geometry are not calculated again.
+  const arma::mat& conditions = get_transfer_plan()->conditions;
+  std::string signature = "conditions (temperature [Kelvin], broadening factor [meV], donor exciton, acceptor exciton):";
+  for (unsigned int c=0; c<conditions.n_rows; c++)
+  {
+    const auto& channel = _channels[int(conditions(c,2))];
+    char values[64];
+    std::snprintf(values, sizeof(values), " (%.17g, %.17g, ", conditions(c,0), conditions(c,1));
+    signature += values + channel[0] + ", " + channel[1] + ")";
+  }
+  const std::string checkpoint_filename = _directory.path() / (name+".checkpoint.dat");
+  sweep_checkpoint checkpoint(checkpoint_filename, "z_shift axis_shift_1 axis_shift_2 angle transfer_rate...", signature, _resume);
+  std::vector<bool> is_done(n, false);
+  for (const auto& record: checkpoint.records())
+  {
+    const int& i = record.first;
+    const std::vector<double>& values = record.second;
+    if ((i >= 0) and (i < n) and (values.size() == 4+unsigned(n_conditions)) and (values[0] == points[i].z_shift) and \
+        (values[1] == points[i].axis_shifts[0]) and (values[2] == points[i].axis_shifts[1]) and (values[3] == points[i].angle)){
+      for (int c=0; c<n_conditions; c++)
+      {
+        transfer_rate(i,c) = values[4+c];
+      }
+      is_done[i] = true;
+    }
+  }
+  std::vector<int> remaining;
+  for (int i=0; i<n; i++)
+  {
+    if (not is_done[i]){
+      remaining.push_back(i);
+    }
+  }
+  if (_resume){
+    std::cout << "resuming " << title << ": " << n-remaining.size() << " of " << n << " points are already calculated\n";
+  }
 
-  progress_bar prog(n_theta, "first order transfer rate versus angle");
-  for (int i=0; i<n_theta; i++)
+  // points are independent and each one writes its own element of transfer_rate. nested parallelism is off, so the \
+     parallel loops inside first_order run serially within each point. a sweep with a single point is left serial so \
+     that it keeps all threads for its inner loops.
+  const int n_remaining = remaining.size();
+  progress_bar prog(n_remaining, title);
+  single_threaded_blas blas_threads;
+  #pragma omp parallel for schedule(dynamic) if(n_remaining > 1)
+  for (int i_remaining=0; i_remaining<n_remaining; i_remaining++)
   {
+    const int i = remaining[i_remaining];
+    const sweep_point_struct& p = points[i];
+    const arma::vec rates = first_order_all_conditions(p.z_shift, p.axis_shifts, p.angle);
+    transfer_rate.row(i) = rates.t();
+    std::vector<double> record = {p.z_shift, p.axis_shifts[0], p.axis_shifts[1], p.angle};
+    record.insert(record.end(), rates.begin(), rates.end());
+    checkpoint.append(i, record);
+    #pragma omp critical (first_order_sweep_progress)
     prog.step();
-    transfer_rate(i) = first_order(z_shift, axis_shifts, angle_vec(i));
   }
 
-  // save the transfer rate
-  std::string filename = _directory.path() / "first_order_transfer_rate_vs_angle.dat";
-  transfer_rate.save(filename,arma::arma_ascii);
+  return transfer_rate;
+};
 
-  // save theta vector
-  filename = _directory.path() / "first_order_transfer_rate_vs_angle.theta.dat";
-  angle_vec.save(filename,arma::arma_ascii);
+// calculate first order transfer rate on a one dimensional sweep that is refined adaptively
+arma::mat exciton_transfer::first_order_adaptive_sweep(arma::vec& x, const std::function<sweep_point_struct(const double&)>& make_point, \
+                                                       const std::string& title, const std::string& name)
+{
+  // evaluate a set of sweep values in parallel and add them to the samples
+  std::map<double,arma::rowvec> samples;
+  auto evaluate = [&](const std::vector<double>& x_list, const std::string& level_title, const std::string& level_name){
+    std::vector<sweep_point_struct> points;
+    for (const auto& x_value: x_list)
+    {
+      points.push_back(make_point(x_value));
+    }
+    const arma::mat values = first_order_sweep(points, level_title, level_name);
+    for (unsigned int i=0; i<x_list.size(); i++)
+    {
+      samples[x_list[i]] = values.row(i);
+    }
+  };
 
-  std::cout << "\n\n";
-  std::cout << "cnt lengths: " << _cnts[0]->length_in_meter()*1.e9 << " [nm], " << _cnts[1]->length_in_meter()*1.e9 << " [nm]\n";
-  std::cout << "center to center distance: " << z_shift*1.e9 << " [nm]\n";
-  std::cout << "cnt1 radius: " << _cnts[0]->radius()*1.e9 << " [nm], cnt2 radius: " << _cnts[1]->radius()*1.e9 << " [nm]\n";
-  std::cout << "wall to wall distance: " << (z_shift - _cnts[0]->radius() - _cnts[1]->radius())*1.e9 << " [nm]\n";
-  std::cout << "axis shifts: " << axis_shifts[0]*1e9 << " [nm] and " << axis_shifts[1]*1e9 << " [nm]\n";
-  std::cout << "max transfer rate: " << transfer_rate.max()/1e12 << " [1/ps] at " << angle_vec(transfer_rate.index_max())*180/constants::pi << " [degrees]\n";
-  std::cout << "min transfer rate: " << transfer_rate.min()/1e12 << " [1/ps] at " << angle_vec(transfer_rate.index_min())*180/constants::pi << " [degrees]\n";
-  std::cout << std::endl;
-}
+  evaluate(std::vector<double>(x.begin(), x.end()), title, name);
 
-// calculate first order transfer rate for center to center distance
-void exciton_transfer::calculate_first_order_vs_zshift(const arma::vec& z_shift_vec, const std::array<double,2> axis_shifts, const double& theta)
-{
-  int n = z_shift_vec.n_elem;
-  arma::vec transfer_rate(arma::size(z_shift_vec), arma::fill::zeros);
+  // all intervals of the initial grid are checked first
+  std::vector<std::array<double,2>> intervals;
+  for (auto it=samples.begin(); std::next(it)!=samples.end(); it++)
+  {
+    intervals.push_back({it->first, std::next(it)->first});
+  }
 
-  progress_bar prog(n, "first order transfer rate versus z_shift");
-  for (int i=0; i<n; i++)
+  // at each level the middle of every interval is calculated, intervals where the linear interpolation of their end \
+     points misses the middle value by more than the tolerance relative to the largest rate are bisected again. with \
+     several conditions an interval is bisected if any of them needs it.
+  for (int level=1; (level<=_adaptive_max_depth) and (not intervals.empty()); level++)
   {
-    prog.step();
-    transfer_rate(i) = first_order(z_shift_vec(i), axis_shifts, theta);
+    std::vector<double> x_middle;
+    for (const auto& interval: intervals)
+    {
+      x_middle.push_back(0.5*(interval[0]+interval[1]));
+    }
+    evaluate(x_middle, title+" (refinement level "+std::to_string(level)+")", name+".refinement_"+std::to_string(level));
+
+    const int n_conditions = samples.begin()->second.n_elem;
+    std::vector<double> scale(n_conditions, 0);
+    for (const auto& sample: samples)
+    {
+      for (int c=0; c<n_conditions; c++)
+      {
+        scale[c] = std::max(scale[c], std::abs(sample.second(c)));
+      }
+    }
+
+    std::vector<std::array<double,2>> next_intervals;
+    for (unsigned int i=0; i<intervals.size(); i++)
+    {
+      bool is_accurate = true;
+      for (int c=0; c<n_conditions; c++)
+      {
+        const double interpolated = 0.5*(samples[intervals[i][0]](c)+samples[intervals[i][1]](c));
+        if (std::abs(samples[x_middle[i]](c)-interpolated) > _adaptive_tolerance*scale[c]){
+          is_accurate = false;
+        }
+      }
+      if (not is_accurate){
+        next_intervals.push_back({intervals[i][0], x_middle[i]});
+        next_intervals.push_back({x_middle[i], intervals[i][1]});
+      }
+    }
+    intervals = next_intervals;
   }
 
-  // save the transfer rate
-  std::string filename = _directory.path() / "first_order_transfer_rate_vs_zshift.dat";
+  x.set_size(samples.size());
+  arma::mat transfer_rate(samples.size(), samples.begin()->second.n_elem);
+  int i = 0;
+  for (const auto& sample: samples)
+  {
+    x(i) = sample.first;
+    transfer_rate.row(i) = sample.second;
+    i++;
+  }
+
+  std::cout << "\n...adaptive sweep used " << samples.size() << " samples";
+  if (not intervals.empty()){
+    std::cout << ", " << intervals.size() << " intervals did not reach the tolerance at the maximum depth";
+  }
+  std::cout << "\n";
+
+  return transfer_rate;
+};
+
+// save the transfer rates of all conditions of the transfer plan
+void exciton_transfer::save_all_conditions(const arma::mat& transfer_rate, const std::string& name)
+{
+  const arma::mat& conditions = get_transfer_plan()->conditions;
+  if (conditions.n_rows < 2){
+    return;
+  }
+
+  std::string filename = _directory.path() / (name+".conditions.dat");
   transfer_rate.save(filename,arma::arma_ascii);
 
-  // save theta vector
-  filename = _directory.path() / "first_order_transfer_rate_vs_zshift.distance.dat";
-  z_shift_vec.save(filename,arma::arma_ascii);
+  filename = _directory.path() / (name+".conditions.parameters.dat");
+  conditions.save(filename,arma::arma_ascii);
+};
+
+// print the summary of a first order transfer rate calculation over a set of geometries
+void exciton_transfer::print_first_order_summary(const std::vector<sweep_point_struct>& points, const arma::vec& transfer_rate, \
+                                                 const std::string& sweep_info) const
+{
+  auto print_point = [&](const int& idx){
+    const sweep_point_struct& p = points[idx];
+    std::cout << p.angle*180/constants::pi << " [degrees], " << p.z_shift*1e9 << " [nm], " \
+              << p.axis_shifts[0]*1e9 << " [nm], " << p.axis_shifts[1]*1e9 << " [nm]\n";
+  };
 
   std::cout << "\n\n";
   std::cout << "cnt lengths: " << _cnts[0]->length_in_meter()*1.e9 << " [nm], " << _cnts[1]->length_in_meter()*1.e9 << " [nm]\n";
   std::cout << "cnt1 radius: " << _cnts[0]->radius()*1.e9 << " [nm], cnt2 radius: " << _cnts[1]->radius()*1.e9 << " [nm]\n";
-  std::cout << "theta: " << theta*180/constants::pi << " [degrees]\n";
-  std::cout << "axis shifts: " << axis_shifts[0]*1e9 << " [nm] and " << axis_shifts[1]*1e9 << " [nm]\n";
-  std::cout << "max transfer rate: " << transfer_rate.max() << " [1/s] at " << z_shift_vec(transfer_rate.index_max())*1e9 << " [nm]\n";
-  std::cout << "min transfer rate: " << transfer_rate.min() << " [1/s] at " << z_shift_vec(transfer_rate.index_min())*1e9 << " [nm]\n";
+  std::cout << sweep_info << "\n";
+  if (transfer_rate.n_elem > 0){
+    std::cout << "max transfer rate: " << transfer_rate.max() << " [1/s] at (angle, zshift, axis shift 1, axis shift 2) = ";
+    print_point(transfer_rate.index_max());
+    std::cout << "min transfer rate: " << transfer_rate.min() << " [1/s] at (angle, zshift, axis shift 1, axis shift 2) = ";
+    print_point(transfer_rate.index_min());
+  }
+  std::cout << "J memo table: " << J_memo_stats()[0] << " hits, " << J_memo_stats()[1] << " misses, " << J_memo_stats()[2] \
+            << " values precomputed by the batch\n";
+  if (_J_method == J_multipole){
+    std::cout << "J multipole error estimate: " << J_max_error_estimate() << " relative to max |J|\n";
+  }
   std::cout << std::endl;
 };
 
-// calculate first order transfer rate for varying axis shift for initial cnt
-void exciton_transfer::calculate_first_order_vs_axis_shift_1(const arma::vec& axis_shift_vec_1, const double axis_shift_2, const double z_shift, const double& theta)
+// calculate first order transfer rate on the cartesian product of the values of (angle, zshift, axis shift 1, axis shift 2)
+void exciton_transfer::calculate_first_order_vs_grid(const std::array<arma::vec,4>& initial_axes)
 {
-  int n = axis_shift_vec_1.n_elem;
-  arma::vec transfer_rate(arma::size(axis_shift_vec_1), arma::fill::zeros);
+  std::array<arma::vec,4> axes = initial_axes;
+
+  // a grid with a single swept axis is a one dimensional sweep. it keeps the file names and axis file suffix of the \
+     one dimensional sweeps of previous versions, and the angle and distance sweeps can be refined adaptively.
+  const std::array<std::string,4> sweep_names = {"angle", "zshift", "axis_shift_1", "axis_shift_2"};
+  const std::array<std::string,4> sweep_titles = {"angle", "z_shift", "axis shift of initial cnt", "axis shift of final cnt"};
+  const std::array<std::string,4> legacy_axis_names = {"theta", "distance", "shift", "shift"};
+  std::vector<int> swept_axes;
+  for (int i=0; i<4; i++)
+  {
+    if (axes[i].n_elem > 1){
+      swept_axes.push_back(i);
+    }
+  }
+  const bool is_1d = (swept_axes.size() == 1);
+  const int i_swept = is_1d ? swept_axes[0] : -1;
+  const std::string name = is_1d ? "first_order_transfer_rate_vs_"+sweep_names[i_swept] : "first_order_transfer_rate_vs_grid";
+  const std::string title = is_1d ? "first order transfer rate versus "+sweep_titles[i_swept] : "first order transfer rate on the grid of geometries";
+
+  std::cout << "\nexciton transfer " << (is_1d ? "versus "+sweep_titles[i_swept] : "on a grid of geometries") << std::endl;
+
+  // geometry of a grid point in the order (angle, zshift, axis shift 1, axis shift 2)
+  auto make_point = [](const std::array<double,4>& x){return sweep_point_struct{x[1], {x[2], x[3]}, x[0]};};
+
+  arma::mat all_transfer_rate;
+  const bool is_adaptive = is_1d and (i_swept < 2) and (_adaptive_tolerance > 0);
+  if (is_adaptive){
+    // in the adaptive mode the values of the swept axis are refined where the transfer rate needs more samples
+    std::array<double,4> x = {axes[0](0), axes[1](0), axes[2](0), axes[3](0)};
+    auto make_1d_point = [&](const double& value){
+      std::array<double,4> x_point = x;
+      x_point[i_swept] = value;
+      return make_point(x_point);
+    };
+    all_transfer_rate = first_order_adaptive_sweep(axes[i_swept], make_1d_point, title, name);
+  }
 
-  progress_bar prog(n, "first order transfer rate versus axis shift of initial cnt");
-  for (int i=0; i<n; i++)
+  // the first axis varies the fastest so the flat result is the grid in column-major order. after an adaptive sweep the \
+     swept axis holds the refined samples in the order of the adaptive result.
+  std::vector<sweep_point_struct> points;
+  for (const auto& axis_shift_2: axes[3])
   {
-    prog.step();
-    std::array<double,2> axis_shifts = {axis_shift_vec_1(i),axis_shift_2};
-    transfer_rate(i) = first_order(z_shift, axis_shifts, theta);
+    for (const auto& axis_shift_1: axes[2])
+    {
+      for (const auto& z_shift: axes[1])
+      {
+        for (const auto& angle: axes[0])
+        {
+          points.push_back(make_point({angle, z_shift, axis_shift_1, axis_shift_2}));
+        }
+      }
+    }
+  }
+  if (not is_adaptive){
+    all_transfer_rate = first_order_sweep(points, title, name);
   }
+  const arma::vec transfer_rate = all_transfer_rate.col(0);
 
   // save the transfer rate
-  std::string filename = _directory.path() / "first_order_transfer_rate_vs_axis_shift_1.dat";
+  std::string filename = _directory.path() / (name+".dat");
   transfer_rate.save(filename,arma::arma_ascii);
+  save_all_conditions(all_transfer_rate, name);
+
+  // save the values along the swept axis, or the shape of the grid and the values along each axis
+  arma::uvec shape = {axes[0].n_elem, axes[1].n_elem, axes[2].n_elem, axes[3].n_elem};
+  std::string sweep_info = "grid shape (angle, zshift, axis shift 1, axis shift 2): " + std::to_string(shape(0)) + " x " + \
+                           std::to_string(shape(1)) + " x " + std::to_string(shape(2)) + " x " + std::to_string(shape(3));
+  if (is_1d){
+    filename = _directory.path() / (name+"."+legacy_axis_names[i_swept]+".dat");
+    axes[i_swept].save(filename,arma::arma_ascii);
+  } else {
+    filename = _directory.path() / (name+".shape.dat");
+    shape.save(filename,arma::arma_ascii);
+
+    const std::array<std::string,4> axis_names = {"theta", "distance", "shift_1", "shift_2"};
+    for (int i=0; i<4; i++)
+    {
+      filename = _directory.path() / (name+"."+axis_names[i]+".dat");
+      axes[i].save(filename,arma::arma_ascii);
+    }
+  }
 
-  // save theta vector
-  filename = _directory.path() / "first_order_transfer_rate_vs_axis_shift_1.shift.dat";
-  axis_shift_vec_1.save(filename,arma::arma_ascii);
-
-  std::cout << "\n\n";
-  std::cout << "cnt lengths: " << _cnts[0]->length_in_meter()*1.e9 << " [nm], " << _cnts[1]->length_in_meter()*1.e9 << " [nm]\n";
-  std::cout << "cnt1 radius: " << _cnts[0]->radius()*1.e9 << " [nm], cnt2 radius: " << _cnts[1]->radius()*1.e9 << " [nm]\n";
-  std::cout << "theta: " << theta*180/constants::pi << " [degrees]\n";
-  std::cout << "center to center distance: " << z_shift*1.e9 << " [nm]\n";
-  std::cout << "max transfer rate: " << transfer_rate.max() << " [1/s] at " << axis_shift_vec_1(transfer_rate.index_max())*1e9 << " [nm]\n";
-  std::cout << "min transfer rate: " << transfer_rate.min() << " [1/s] at " << axis_shift_vec_1(transfer_rate.index_min())*1e9 << " [nm]\n";
-  std::cout << std::endl;
+  print_first_order_summary(points, transfer_rate, sweep_info);
 };
 
-// calculate first order transfer rate for varying axis shift for final cnt
-void exciton_transfer::calculate_first_order_vs_axis_shift_2(const arma::vec& axis_shift_vec_2, const double axis_shift_1, const double z_shift, const double& theta)
+// calculate first order transfer rate for a list of geometries given as rows of (angle, zshift, axis shift 1, axis shift 2)
+void exciton_transfer::calculate_first_order_vs_geometry_list(const arma::mat& geometries)
 {
-  int n = axis_shift_vec_2.n_elem;
-  arma::vec transfer_rate(arma::size(axis_shift_vec_2), arma::fill::zeros);
+  std::cout << "\nexciton transfer versus list of geometries" << std::endl;
 
-  progress_bar prog(n, "first order transfer rate versus axis shift of final cnt");
-  for (int i=0; i<n; i++)
+  std::vector<sweep_point_struct> points;
+  for (unsigned int i=0; i<geometries.n_rows; i++)
   {
-    prog.step();
-    std::array<double,2> axis_shifts = {axis_shift_1, axis_shift_vec_2(i)};
-    transfer_rate(i) = first_order(z_shift, axis_shifts, theta);
+    points.push_back({geometries(i,1), {geometries(i,2), geometries(i,3)}, geometries(i,0)});
   }
+  const arma::mat all_transfer_rate = first_order_sweep(points, "first order transfer rate versus list of geometries", "first_order_transfer_rate_vs_geometry");
+  const arma::vec transfer_rate = all_transfer_rate.col(0);
 
   // save the transfer rate
-  std::string filename = _directory.path() / "first_order_transfer_rate_vs_axis_shift_2.dat";
+  std::string filename = _directory.path() / "first_order_transfer_rate_vs_geometry.dat";
   transfer_rate.save(filename,arma::arma_ascii);
+  save_all_conditions(all_transfer_rate, "first_order_transfer_rate_vs_geometry");
 
-  // save theta vector
-  filename = _directory.path() / "first_order_transfer_rate_vs_axis_shift_2.shift.dat";
-  axis_shift_vec_2.save(filename,arma::arma_ascii);
+  // save the geometries
+  filename = _directory.path() / "first_order_transfer_rate_vs_geometry.geometry.dat";
+  geometries.save(filename,arma::arma_ascii);
 
-  std::cout << "\n\n";
-  std::cout << "cnt lengths: " << _cnts[0]->length_in_meter()*1.e9 << " [nm], " << _cnts[1]->length_in_meter()*1.e9 << " [nm]\n";
-  std::cout << "cnt1 radius: " << _cnts[0]->radius()*1.e9 << " [nm], cnt2 radius: " << _cnts[1]->radius()*1.e9 << " [nm]\n";
-  std::cout << "theta: " << theta*180/constants::pi << " [degrees]\n";
-  std::cout << "center to center distance: " << z_shift*1.e9 << " [nm]\n";
-  std::cout << "max transfer rate: " << transfer_rate.max() << " [1/s] at " << axis_shift_vec_2(transfer_rate.index_max())*1e9 << " [nm]\n";
-  std::cout << "min transfer rate: " << transfer_rate.min() << " [1/s] at " << axis_shift_vec_2(transfer_rate.index_min())*1e9 << " [nm]\n";
-  std::cout << std::endl;
-};
\ No newline at end of file
+  print_first_order_summary(points, transfer_rate, "number of geometries: "+std::to_string(geometries.n_rows));
+};
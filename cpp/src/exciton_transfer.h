@@ -6,9 +6,17 @@
 #include <experimental/filesystem>
 #include <armadillo>
 #include <type_traits>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <unordered_map>
+#include <functional>
+#include <algorithm>
+#include <cmath>
 
 #include "cnt.h"
 #include "prepare_directory.hpp"
+#include "coulomb_kernel.h"
 
 class exciton_transfer
 {
@@ -19,17 +27,136 @@ private:
   std::string _name;
   double _temperature; // temperature of the system to calculate thermal distribution for excitons and other particles
   double _broadening_factor; // broadening factor used in the lorenzian to simulate dirac delta function
+  std::vector<double> _temperatures; // all temperatures for which the transfer rates are calculated, the first one is _temperature
+  std::vector<double> _broadening_factors; // all broadening factors for which the transfer rates are calculated, the first one is _broadening_factor
+  std::vector<std::array<std::string,2>> _channels = {{"A2 singlet","A2 singlet"}}; // (donor, acceptor) exciton types of each transfer channel
+
+  // get the exciton of a cnt by the name of its type: "A1", "A2 triplet", or "A2 singlet"
+  const cnt::exciton_struct& channel_exciton(const cnt& m_cnt, const std::string& exciton_type) const
+  {
+    if (exciton_type == "A1") {
+      return m_cnt.A1();
+    } else if (exciton_type == "A2 triplet") {
+      return m_cnt.A2_triplet();
+    } else if (exciton_type == "A2 singlet") {
+      return m_cnt.A2_singlet();
+    }
+    throw std::invalid_argument("exciton type should be either \"A1\", \"A2 triplet\", or \"A2 singlet\"!!!");
+  };
   std::array<const cnt*,2> _cnts = {nullptr,nullptr}; // array of pointers to the target excitons
 
   enum simulation_mode {ex_trans_vs_angle, ex_trans_vs_zshift, ex_trans_vs_axis_shift_1, ex_trans_vs_axis_shift_2};
   simulation_mode _sim_mode;
 
+  enum J_methods {J_direct, J_batched, J_treecode, J_multipole}; // methods to calculate J: one pair of states at a time, \
+                                                                    all momentum pairs at once, all momentum pairs with a \
+                                                                    treecode over the acceptor, or all momentum pairs with \
+                                                                    a multipole expansion of distant cnt unit cells
+  J_methods _J_method = J_direct; // method used in first_order
+  double _J_accuracy = 1.e-4; // relative accuracy target of the far-field expansion in the treecode method
+  double _J_multipole_cutoff = 10.e-9; // distance between centers of cnt unit cells beyond which the multipole method uses \
+                                          the monopole and dipole expansion of the unit cells
+  std::atomic<double> _J_max_error_estimate{0}; // largest estimated error of J relative to max |J| over all geometries
+
+  bool _resume = false; // skip the sweep points that are already in the checkpoint files of a previous run
+  double _adaptive_tolerance = 0; // tolerance of the adaptive angle and distance sweeps relative to the largest rate, 0 to disable
+  int _adaptive_max_depth = 6; // maximum number of times an interval of the initial grid is bisected in the adaptive sweeps
   nlohmann::json _j_prop;
 
+  // struct to hold position of all atoms of the donor (index 0) and acceptor (index 1) cnts at a single geometry in the \
+     structure-of-arrays form. it is built once per geometry and shared by all pairs of states evaluated at that geometry.
+  struct geometry_struct
+  {
+    std::array<double,2> shifts_along_axis; // shift of each cnt along its own axis
+    double z_shift; // center to center distance of the cnts along the z axis
+    double angle; // rotation angle of the acceptor cnt around the z axis
+    std::array<std::array<std::vector<double>,3>,2> Ru_3d; // (x,y,z) position of the atoms of each cnt in 3d space
+    std::array<std::array<std::vector<double>,2>,2> Ru_2d; // (x,y) position of the atoms of each cnt in the 2d space of unrolled cnt
+    std::array<int,2> n_atoms_in_cell; // number of atoms in the unit cell of each cnt, atoms of each unit cell are contiguous
+
+    // check if the geometry is built for the given shifts and angle
+    bool is_same(const std::array<double,2>& m_shifts_along_axis, const double& m_z_shift, const double& m_angle) const
+    {
+      return (shifts_along_axis == m_shifts_along_axis) and (z_shift == m_z_shift) and (angle == m_angle);
+    };
+  };
+
+  mutable std::shared_ptr<const geometry_struct> _geometry; // cache of the last geometry used to calculate J
+  mutable std::mutex _geometry_mutex; // lock to access the geometry cache
+
+  // table of the part of the Q matrix element that belongs to each state of an exciton in the form (ik_cm_idx, i_principal). \
+     Q does not depend on the geometry, so the table of each exciton is calculated once and shared by all pairs of states.
+  mutable std::unordered_map<const cnt::exciton_struct*, arma::cx_mat> _Q_partial_tables;
+  mutable std::mutex _Q_partial_mutex; // lock to access the Q tables
+
+  // plan of the first order transfer rate, made on first use. the struct is defined after the class.
+  struct transfer_plan_struct;
+  std::shared_ptr<const transfer_plan_struct> _transfer_plan;
+  std::mutex _transfer_plan_mutex; // lock to access the transfer plan
+
+  // memo table of J values at a single geometry. J only depends on the center of mass momenta of the initial and final \
+     states, so all pairs of states with the same (ik_cm_i, ik_cm_f) share one entry regardless of their principal \
+     quantum number or exciton type.
+  struct J_memo_struct
+  {
+    // J value of an (ik_cm_i, ik_cm_f) pair and whether it has been looked up
+    struct entry_struct
+    {
+      std::complex<double> J;
+      bool is_used;
+    };
+    std::unordered_map<long long,entry_struct> values; // J values keyed by (ik_cm_i, ik_cm_f)
+    long long hits = 0; // number of lookups of a key that was already looked up before
+    long long misses = 0; // number of first lookups of a key, i.e. the number of distinct J values that are needed
+    long long precomputed = 0; // number of J values added by insert() ahead of their lookups
+
+    // unique key of an (ik_cm_i, ik_cm_f) pair for the hash table
+    static long long key(const int& ik_cm_i, const int& ik_cm_f)
+    {
+      return static_cast<long long>(ik_cm_i)*(1LL<<32) + static_cast<unsigned int>(ik_cm_f);
+    };
+
+    // add a J value that is calculated elsewhere
+    void insert(const int& ik_cm_i, const int& ik_cm_f, const std::complex<double>& J)
+    {
+      if (values.emplace(key(ik_cm_i,ik_cm_f),entry_struct{J,false}).second){
+        precomputed++;
+      }
+    };
+
+    // get J from the table or calculate it using calculate_J() if it is not there
+    template <typename calculate_type>
+    std::complex<double> get(const int& ik_cm_i, const int& ik_cm_f, const calculate_type& calculate_J)
+    {
+      const auto it = values.find(key(ik_cm_i,ik_cm_f));
+      if (it != values.end()){
+        if (it->second.is_used){
+          hits++;
+        } else {
+          misses++;
+          it->second.is_used = true;
+        }
+        return it->second.J;
+      }
+      misses++;
+      return values.emplace(key(ik_cm_i,ik_cm_f),entry_struct{calculate_J(),true}).first->second.J;
+    };
+  };
+
+  std::atomic<long long> _J_memo_hits{0}; // total number of J lookups served from the memo tables
+  std::atomic<long long> _J_memo_misses{0}; // total number of distinct J values needed by the memo tables
+  std::atomic<long long> _J_memo_precomputed{0}; // total number of J values precomputed by the batched methods
+
   // function to return the lorentzian based on the broadening factor
   const double lorentzian(const double& energy)
   {
-    return constants::inv_pi*_broadening_factor/(energy*energy + _broadening_factor*_broadening_factor);
+    return lorentzian(energy, _broadening_factor);
+  };
+
+  // function to return the lorentzian for a given broadening factor
+  const double lorentzian(const double& energy, const double& broadening_factor) const
+  {
+    return constants::inv_pi*broadening_factor/(energy*energy + broadening_factor*broadening_factor);
   };
 
 public:
@@ -41,6 +168,8 @@ public:
     _cnts = {&cnt1, &cnt2};
     _temperature = 300;
     _broadening_factor = 4.e-3*constants::eV;
+    _temperatures = {_temperature};
+    _broadening_factors = {_broadening_factor};
 
     std::cout << "\n...exciton transfer parameters:\n";
     std::cout << "temperature: " << _temperature << " [Kelvin]\n";
@@ -76,14 +205,118 @@ public:
     if (j.count("keep old results")==1){
       keep_old_results = j["keep old results"];
     }
-    _directory = prepare_directory(directory_path, keep_old_results);
+    if (j.count("resume")==1){
+      _resume = j["resume"];
+    }
+    // when resuming the existing directory is used as it is so that the checkpoint files of the previous run are kept
+    if (_resume and fs::is_directory(directory_path)){
+      std::cout << "\n...\nresuming in directory: " << directory_path << "\n...\n" << std::endl;
+      _directory.assign(directory_path);
+    } else {
+      _directory = prepare_directory(directory_path, keep_old_results);
+    }
 
-    _temperature = j["temperature [Kelvin]"];
-    _broadening_factor = double(j["broadening factor [meV]"])*1.e-3*constants::eV;
+    // temperature and broadening factor can be either a single value or a list of values. the rates for all \
+       combinations are calculated in one pass and the first values are used wherever a single value is needed.
+    auto read_list = [&](const std::string& key, const double& scale){
+      std::vector<double> values;
+      if (j[key].is_array()){
+        for (const auto& value: j[key])
+        {
+          values.push_back(double(value)*scale);
+        }
+      } else {
+        values.push_back(double(j[key])*scale);
+      }
+      if (values.empty()){
+        throw std::invalid_argument(key + " should not be an empty list!!!");
+      }
+      return values;
+    };
+    _temperatures = read_list("temperature [Kelvin]", 1);
+    _broadening_factors = read_list("broadening factor [meV]", 1.e-3*constants::eV);
+    _temperature = _temperatures[0];
+    _broadening_factor = _broadening_factors[0];
+
+    // transfer channels in the form [[donor exciton type, acceptor exciton type], ...], all channels share the J values
+    if (j.count("exciton channels")==1){
+      _channels.clear();
+      for (const auto& channel: j["exciton channels"])
+      {
+        if (channel.size()!=2){
+          throw std::invalid_argument("each exciton channel should be given as [donor exciton type, acceptor exciton type]!!!");
+        }
+        _channels.push_back({channel[0].get<std::string>(), channel[1].get<std::string>()});
+        for (const auto& exciton_type: _channels.back())
+        {
+          if ((exciton_type != "A1") and (exciton_type != "A2 triplet") and (exciton_type != "A2 singlet")){
+            throw std::invalid_argument("exciton type should be either \"A1\", \"A2 triplet\", or \"A2 singlet\"!!!");
+          }
+        }
+      }
+      if (_channels.empty()){
+        throw std::invalid_argument("exciton channels should not be an empty list!!!");
+      }
+    }
 
     std::cout << "\n...exciton transfer parameters:\n";
-    std::cout << "temperature: " << _temperature << " [Kelvin]\n";
-    std::cout << "energy broadening factor: " << _broadening_factor*1.e3/constants::eV << " [meV]\n";
+    std::cout << "exciton channels:";
+    for (const auto& channel: _channels) std::cout << " [" << channel[0] << " -> " << channel[1] << "]";
+    std::cout << "\n";
+    std::cout << "temperature:";
+    for (const auto& temperature: _temperatures) std::cout << " " << temperature;
+    std::cout << " [Kelvin]\n";
+    std::cout << "energy broadening factor:";
+    for (const auto& broadening_factor: _broadening_factors) std::cout << " " << broadening_factor*1.e3/constants::eV;
+    std::cout << " [meV]\n";
+
+    // method to calculate J
+    if (j.count("J method")==1){
+      std::string J_method = j["J method"];
+      if (J_method == "direct") {
+        _J_method = J_direct;
+      } else if (J_method == "batched") {
+        _J_method = J_batched;
+      } else if (J_method == "treecode") {
+        _J_method = J_treecode;
+      } else if (J_method == "multipole") {
+        _J_method = J_multipole;
+      } else {
+        throw std::invalid_argument("J method should be either \"direct\", \"batched\", \"treecode\", or \"multipole\"!!!");
+      }
+      std::cout << "J method: " << J_method << "\n";
+    }
+    if (j.count("J accuracy")==1){
+      _J_accuracy = j["J accuracy"];
+      if (_J_accuracy <= 0){
+        throw std::invalid_argument("J accuracy should be positive!!!");
+      }
+    }
+    if (_J_method == J_treecode){
+      std::cout << "J accuracy: " << _J_accuracy << "\n";
+    }
+    if (j.count("adaptive tolerance")==1){
+      _adaptive_tolerance = j["adaptive tolerance"];
+      if (_adaptive_tolerance < 0){
+        throw std::invalid_argument("adaptive tolerance should not be negative!!!");
+      }
+    }
+    if (j.count("adaptive max depth")==1){
+      _adaptive_max_depth = j["adaptive max depth"];
+    }
+    if (_adaptive_tolerance > 0){
+      std::cout << "adaptive sweep tolerance: " << _adaptive_tolerance << ", maximum depth: " << _adaptive_max_depth << "\n";
+    }
+    if (j.count("J multipole cutoff [nm]")==1){
+      _J_multipole_cutoff = double(j["J multipole cutoff [nm]"])*1.e-9;
+      if (_J_multipole_cutoff < 0){
+        throw std::invalid_argument("J multipole cutoff should not be negative!!!");
+      }
+    }
+    if (_J_method == J_multipole){
+      std::cout << "J multipole cutoff: " << _J_multipole_cutoff*1.e9 << " [nm]\n";
+    }
+    std::cout << "coulomb kernel instruction set: " << coulomb_kernel_isa() << "\n";
 
     _j_prop = j;
   };
@@ -156,27 +389,135 @@ public:
     const ex_state f; // final exciton state
   };
 
+  // make the plan of the first order transfer rate
+  std::shared_ptr<const transfer_plan_struct> make_transfer_plan();
+
+  // get the plan of the first order transfer rate, the plan is made the first time it is requested
+  std::shared_ptr<const transfer_plan_struct> get_transfer_plan()
+  {
+    std::lock_guard<std::mutex> lock(_transfer_plan_mutex);
+    if (not _transfer_plan){
+      _transfer_plan = make_transfer_plan();
+    }
+    return _transfer_plan;
+  };
+
   // get the energetically relevant states in the form a vector of ex_state structs
-  std::vector<ex_state> get_relevant_states(const cnt::exciton_struct& exciton, const double min_energy);
+  std::vector<ex_state> get_relevant_states(const cnt::exciton_struct& exciton, const double min_energy, const double temperature);
+
+  // get the energetically relevant states at _temperature
+  std::vector<ex_state> get_relevant_states(const cnt::exciton_struct& exciton, const double min_energy)
+  {
+    return get_relevant_states(exciton, min_energy, _temperature);
+  };
+
+  // energy above which the population of the states relative to the state at min_energy is negligible
+  double relevant_energy_threshold(const double& min_energy, const double& temperature) const
+  {
+    const double threshold_population = 1.e-3;
+    return min_energy+std::abs(std::log(threshold_population) * constants::kb*temperature);
+  };
+
+  // build the geometry of the donor and acceptor cnts for the given shifts and angle
+  std::shared_ptr<const geometry_struct> make_geometry(const std::array<double,2>& shifts_along_axis, const double& z_shift, const double& angle) const;
+
+  // get the geometry for the given shifts and angle from the cache, the cache is rebuilt only when the geometry changes
+  std::shared_ptr<const geometry_struct> get_geometry(const std::array<double,2>& shifts_along_axis, const double& z_shift, const double& angle) const
+  {
+    {
+      std::lock_guard<std::mutex> lock(_geometry_mutex);
+      if (_geometry and _geometry->is_same(shifts_along_axis, z_shift, angle)){
+        return _geometry;
+      }
+    }
+    // build outside of the lock so that threads working on different geometries do not wait for each other
+    auto geometry = make_geometry(shifts_along_axis, z_shift, angle);
+    std::lock_guard<std::mutex> lock(_geometry_mutex);
+    _geometry = geometry;
+    return geometry;
+  };
+
+  // calculate the part of the Q matrix element for all states of an exciton in the form (ik_cm_idx, i_principal)
+  arma::cx_mat calculate_Q_partial_table(const cnt::exciton_struct& exciton) const;
+
+  // get the table of the partial Q matrix elements of an exciton, the table is calculated the first time it is requested
+  const arma::cx_mat& get_Q_partial_table(const cnt::exciton_struct& exciton) const
+  {
+    std::lock_guard<std::mutex> lock(_Q_partial_mutex);
+    auto it = _Q_partial_tables.find(&exciton);
+    if (it == _Q_partial_tables.end()){
+      it = _Q_partial_tables.emplace(&exciton, calculate_Q_partial_table(exciton)).first;
+    }
+    return it->second;
+  };
 
   // calculate Q()
   std::complex<double> calculate_Q(const matching_states& pair) const;
 
   // calculate J()
-  std::complex<double> calculate_J(const matching_states& pair, const std::array<double,2>& shifts_along_axis, const double& z_shift, const double& angle) const;
+  std::complex<double> calculate_J(const matching_states& pair, const std::array<double,2>& shifts_along_axis, const double& z_shift, const double& angle) const
+  {
+    return calculate_J(pair, *get_geometry(shifts_along_axis, z_shift, angle));
+  };
+
+  // calculate J() for a geometry that is already built
+  std::complex<double> calculate_J(const matching_states& pair, const geometry_struct& geometry) const;
+
+  // calculate J() for all combinations of the given initial and final center of mass momenta at once in the form \
+     (i_ik_cm index, f_ik_cm index)
+  arma::cx_mat calculate_J_batched(const std::vector<int>& i_ik_cm, const std::vector<int>& f_ik_cm, const geometry_struct& geometry) const;
+
+  // calculate J() for all combinations of the given initial and final center of mass momenta using a treecode over the \
+     atoms of the acceptor cnt. the result has the same format as calculate_J_batched.
+  arma::cx_mat calculate_J_treecode(const std::vector<int>& i_ik_cm, const std::vector<int>& f_ik_cm, const geometry_struct& geometry) const;
+
+  // calculate J() for all combinations of the given initial and final center of mass momenta by summing the interaction of \
+     nearby cnt unit cells exactly and replacing the interaction of unit cells farther apart than _J_multipole_cutoff by \
+     the monopole and dipole expansion of their phase-weighted charge. error_estimate is an upper bound of the neglected \
+     quadrupole order terms in the same units as J. the result has the same format as calculate_J_batched.
+  arma::cx_mat calculate_J_multipole(const std::vector<int>& i_ik_cm, const std::vector<int>& f_ik_cm, const geometry_struct& geometry, \
+                                     double& error_estimate) const;
+
+  // phase factors exp(+i*k.R) of the atoms of one cnt (0 for donor and 1 for acceptor) in the format (atom, ik_cm index)
+  arma::cx_mat make_phase_matrix(const int& i_cnt, const std::vector<int>& ik_cm, const geometry_struct& geometry) const;
 
   // match states based on energies
   std::vector<matching_states> match_states(const std::vector<ex_state>& d_relevant_states, const std::vector<ex_state>& a_relevant_states)
+  {
+    return match_states(d_relevant_states, a_relevant_states, _broadening_factor);
+  };
+
+  // match states based on energies for a given broadening factor
+  std::vector<matching_states> match_states(const std::vector<ex_state>& d_relevant_states, const std::vector<ex_state>& a_relevant_states, \
+                                            const double& broadening_factor) const
   {
     std::vector<matching_states> matched;
-    
+
+    // acceptor states in the order of their energies, get_relevant_states already returns them sorted
+    std::vector<const ex_state*> a_sorted;
+    for (const auto& a_state: a_relevant_states)
+    {
+      a_sorted.push_back(&a_state);
+    }
+    auto energy_less = [](const ex_state* s1, const ex_state* s2){return s1->energy < s2->energy;};
+    if (not std::is_sorted(a_sorted.begin(), a_sorted.end(), energy_less)){
+      std::stable_sort(a_sorted.begin(), a_sorted.end(), energy_less);
+    }
+
+    // lorentzian(dE) > 1e-2*lorentzian(0) is equivalent to |dE| < sqrt(99)*broadening, so only the acceptor states in \
+       this energy window are checked.
+    const double max_delta_e = std::sqrt(99.)*broadening_factor;
     for (const auto& d_state: d_relevant_states)
     {
-      for (const auto& a_state: a_relevant_states)
+      auto begin = std::lower_bound(a_sorted.begin(), a_sorted.end(), d_state.energy-max_delta_e, \
+                                    [](const ex_state* a_state, const double& energy){return a_state->energy < energy;});
+      auto end = std::upper_bound(begin, a_sorted.end(), d_state.energy+max_delta_e, \
+                                  [](const double& energy, const ex_state* a_state){return energy < a_state->energy;});
+      for (auto it=begin; it!=end; it++)
       {
-        if (is_matched(d_state, a_state))
+        if (is_matched(d_state, **it, broadening_factor))
         {
-          matched.emplace_back(matching_states(d_state,a_state));
+          matched.emplace_back(matching_states(d_state,**it));
         }
       }
     }
@@ -196,9 +537,15 @@ public:
 
   // function to check if a state is energetically matched using a lorentzian
   bool is_matched(const ex_state& d_state, const ex_state& a_state)
+  {
+    return is_matched(d_state, a_state, _broadening_factor);
+  };
+
+  // function to check if a state is energetically matched using a lorentzian with a given broadening factor
+  bool is_matched(const ex_state& d_state, const ex_state& a_state, const double& broadening_factor) const
   {
     double delta_e = d_state.energy - a_state.energy;
-    if (lorentzian(delta_e) > 1.e-2*lorentzian(0))
+    if (lorentzian(delta_e, broadening_factor) > 1.e-2*lorentzian(0, broadening_factor))
     {
       return true;
     }
@@ -232,20 +579,60 @@ public:
   // calculate and plot J matrix element between two exciton bands
   void save_J_matrix_element(const int i_n_principal, const int f_n_principal);
 
+  // total number of hits, misses, and values precomputed by the batched methods of the J memo tables over all \
+     geometries calculated so far
+  std::array<long long,3> J_memo_stats() const
+  {
+    return {_J_memo_hits.load(), _J_memo_misses.load(), _J_memo_precomputed.load()};
+  };
+
+  // largest estimated relative error of J in the multipole method over all geometries calculated so far
+  double J_max_error_estimate() const
+  {
+    return _J_max_error_estimate.load();
+  };
+
   // calculate first order transfer rate
-  double first_order(const double& z_shift, const std::array<double,2> axis_shifts, const double& theta, const bool& show_results=false);
+  double first_order(const double& z_shift, const std::array<double,2> axis_shifts, const double& theta, const bool& show_results=false)
+  {
+    return first_order_all_conditions(z_shift, axis_shifts, theta, show_results)(0);
+  };
+
+  // calculate first order transfer rate for all conditions of the transfer plan in the order of the plan conditions
+  arma::vec first_order_all_conditions(const double& z_shift, const std::array<double,2> axis_shifts, const double& theta, const bool& show_results=false);
+
+  // save the transfer rates of all conditions as <name>.conditions.dat in the form (point, condition) together with the \
+     conditions in <name>.conditions.parameters.dat. nothing is saved when there is only one condition.
+  void save_all_conditions(const arma::mat& transfer_rate, const std::string& name);
+
+  // geometry of a single point of a sweep
+  struct sweep_point_struct
+  {
+    double z_shift; // center to center distance of the cnts along the z axis
+    std::array<double,2> axis_shifts; // shift of each cnt along its own axis
+    double angle; // rotation angle of the acceptor cnt around the z axis
+  };
+
+  // calculate first order transfer rate at all points of a sweep in parallel in the form (point, condition). finished \
+     points are streamed to the checkpoint file <name>.checkpoint.dat in the output directory.
+  arma::mat first_order_sweep(const std::vector<sweep_point_struct>& points, const std::string& title, const std::string& name);
 
-  // calculate first order transfer rate for varying angle
-  void calculate_first_order_vs_angle(const arma::vec& angle_vec ,const double& z_shift, const std::array<double,2> axis_shifts);
+  // calculate first order transfer rate for a one dimensional sweep starting from the grid x and bisecting the intervals \
+     where the linear interpolation error is above _adaptive_tolerance. x is replaced by the refined sample set, make_point \
+     turns a value of x into the geometry of a sweep point. the result is in the form (sample, condition).
+  arma::mat first_order_adaptive_sweep(arma::vec& x, const std::function<sweep_point_struct(const double&)>& make_point, \
+                                       const std::string& title, const std::string& name);
 
-  // calculate first order transfer rate for center to center distance
-  void calculate_first_order_vs_zshift(const arma::vec& z_shift_vec, const std::array<double,2> axis_shifts, const double& theta);
+  // print the cnt dimensions, the sweep_info line, the extremes of transfer_rate over the points, and the J statistics
+  void print_first_order_summary(const std::vector<sweep_point_struct>& points, const arma::vec& transfer_rate, const std::string& sweep_info) const;
 
-  // calculate first order transfer rate for varying axis shift for initial cnt
-  void calculate_first_order_vs_axis_shift_1(const arma::vec& axis_shift_vec_1, const double axis_shift_2, const double z_shift, const double& theta);
+  // calculate first order transfer rate on the cartesian product of the values of (angle, zshift, axis shift 1, axis shift 2). \
+     the result is saved as a flat vector with the angle varying the fastest. a grid with a single swept axis is saved \
+     under the name of the one dimensional sweep of that axis and is refined adaptively for the angle and zshift axes.
+  void calculate_first_order_vs_grid(const std::array<arma::vec,4>& initial_axes);
 
-  // calculate first order transfer rate for varying axis shift for final cnt
-  void calculate_first_order_vs_axis_shift_2(const arma::vec& axis_shift_vec_2, const double axis_shift_1, const double z_shift, const double& theta);
+  // calculate first order transfer rate for a list of geometries given as rows of (angle, zshift, axis shift 1, axis shift 2)
+  void calculate_first_order_vs_geometry_list(const arma::mat& geometries);
 
   void run()
   {
@@ -254,67 +641,53 @@ public:
       if (_j_prop["skip"]) return;
     }
 
-    // determine the execution policy
-    if ((_j_prop["angle [degrees]"].size()==3) &&
-        (_j_prop["zshift [nm]"].size()==1)     && 
-        (_j_prop["axis shift 1 [nm]"].size()==1) &&
-        (_j_prop["axis shift 2 [nm]"].size()==1))
+    // explicit list of geometries in the form [angle [degrees], zshift [nm], axis shift 1 [nm], axis shift 2 [nm]]
+    if (_j_prop.count("geometries")==1)
     {
-      std::cout << "\nexciton transfer versus angle" << std::endl;
-
-      double z_shift = double(_j_prop["zshift [nm]"][0])*1.e-9;
-      std::array<double,2> axis_shifts={double(_j_prop["axis shift 1 [nm]"][0])*1.e-9, double(_j_prop["axis shift 2 [nm]"][0])*1.e-9};
-
-      arma::vec angle_vec = arma::linspace<arma::vec>(_j_prop["angle [degrees]"][0],_j_prop["angle [degrees]"][1],_j_prop["angle [degrees]"][2])*constants::pi/180;
-
-      calculate_first_order_vs_angle(angle_vec, z_shift, axis_shifts);
-    }
-    else if ((_j_prop["angle [degrees]"].size()==1) &&
-        (_j_prop["zshift [nm]"].size()==3)     && 
-        (_j_prop["axis shift 1 [nm]"].size()==1) &&
-        (_j_prop["axis shift 2 [nm]"].size()==1))
-    {
-      std::cout << "\nexciton transfer versus z_shift" << std::endl;
-      
-      arma::vec z_shift_vec = arma::linspace<arma::vec>(_j_prop["zshift [nm]"][0],_j_prop["zshift [nm]"][1],_j_prop["zshift [nm]"][2])*1.e-9;
-      std::array<double,2> axis_shifts={double(_j_prop["axis shift 1 [nm]"][0])*1.e-9, double(_j_prop["axis shift 2 [nm]"][0])*1.e-9};
-
-      double angle = double(_j_prop["angle [degrees]"][0])*constants::pi/180;
-      calculate_first_order_vs_zshift(z_shift_vec, axis_shifts, angle);
-    }
-    else if ((_j_prop["angle [degrees]"].size()==1) &&
-             (_j_prop["zshift [nm]"].size()==1)     && 
-             (_j_prop["axis shift 1 [nm]"].size()==3) &&
-             (_j_prop["axis shift 2 [nm]"].size()==1))
-    {
-      std::cout << "\nexciton transfer versus axis shift 1" << std::endl;
-
-      arma::vec axis_shift_vec_1 = arma::linspace<arma::vec>(_j_prop["axis shift 1 [nm]"][0],_j_prop["axis shift 1 [nm]"][1],_j_prop["axis shift 1 [nm]"][2])*1.e-9;
-      double axis_shift_2 = double(_j_prop["axis shift 2 [nm]"][0])*1.e-9;
-      double z_shift = double(_j_prop["zshift [nm]"][0])*1.e-9;
-
-      double angle = double(_j_prop["angle [degrees]"][0])*constants::pi/180;
-      calculate_first_order_vs_axis_shift_1(axis_shift_vec_1, axis_shift_2, z_shift, angle);
+      arma::mat geometries(_j_prop["geometries"].size(), 4);
+      for (unsigned int i=0; i<geometries.n_rows; i++)
+      {
+        if (_j_prop["geometries"][i].size()!=4){
+          throw std::invalid_argument("each geometry should be given as [angle, zshift, axis shift 1, axis shift 2]!!!");
+        }
+        geometries(i,0) = double(_j_prop["geometries"][i][0])*constants::pi/180;
+        for (int j=1; j<4; j++)
+        {
+          geometries(i,j) = double(_j_prop["geometries"][i][j])*1.e-9;
+        }
+      }
+      calculate_first_order_vs_geometry_list(geometries);
+      return;
     }
-    else if ((_j_prop["angle [degrees]"].size()==1) &&
-             (_j_prop["zshift [nm]"].size()==1)     && 
-             (_j_prop["axis shift 1 [nm]"].size()==1) &&
-             (_j_prop["axis shift 2 [nm]"].size()==3))
-    {
-      std::cout << "\nexciton transfer versus axis shift 2" << std::endl;
 
-      arma::vec axis_shift_vec_2 = arma::linspace<arma::vec>(_j_prop["axis shift 2 [nm]"][0],_j_prop["axis shift 2 [nm]"][1],_j_prop["axis shift 2 [nm]"][2])*1.e-9;
-      double axis_shift_1 = double(_j_prop["axis shift 1 [nm]"][0])*1.e-9;
-      double z_shift = double(_j_prop["zshift [nm]"][0])*1.e-9;
-
-      double angle = double(_j_prop["angle [degrees]"][0])*constants::pi/180;
-      calculate_first_order_vs_axis_shift_2(axis_shift_vec_2, axis_shift_1, z_shift, angle);
-    }
-    else
-    {
+    // fixed and swept parameters are calculated on the full grid of their values, a single swept parameter is a one \
+       dimensional sweep
+    auto make_axis = [&](const std::string& key, const double& scale){
+      if (_j_prop[key].size()==1){
+        return arma::vec({double(_j_prop[key][0])*scale});
+      }
+      if (_j_prop[key].size()==3){
+        return arma::vec(arma::linspace<arma::vec>(_j_prop[key][0],_j_prop[key][1],_j_prop[key][2])*scale);
+      }
       throw std::logic_error("Invalid format for specifications of the exciton transfer simulation.");
-    }
+    };
+
+    std::array<arma::vec,4> axes = {make_axis("angle [degrees]", constants::pi/180), make_axis("zshift [nm]", 1.e-9), \
+                                    make_axis("axis shift 1 [nm]", 1.e-9), make_axis("axis shift 2 [nm]", 1.e-9)};
+    calculate_first_order_vs_grid(axes);
   };
 };
 
+// everything in the first order transfer rate that does not depend on the geometry. the rate at any geometry is \
+   sum_p weight(p,c)*|J(pair p)|^2 for condition c, so sweeps only need to calculate J against a plan that is made once.
+struct exciton_transfer::transfer_plan_struct
+{
+  std::vector<matching_states> state_pairs; // pairs of donor and acceptor states with matching energies
+  arma::mat weight; // (2pi/hbar)*(boltzmann population)*|Q|^2/(L_i*L_f)*lorentzian in the form (pair, condition)
+  arma::mat conditions; // temperature [Kelvin], broadening factor [meV], and channel index of each condition in the form \
+                           (condition, parameter) with the temperature varying the fastest and the channel the slowest. \
+                           the first condition is (_temperature, _broadening_factor, first channel).
+  std::array<std::vector<int>,2> ik_cm_list; // sorted list of distinct ik_cm of the initial and final states
+};
+
 #endif //_exciton_transfer_h_
\ No newline at end of file
@@ -0,0 +1,123 @@
+#ifndef _lanczos_hpp_
+#define _lanczos_hpp_
+
+#include <armadillo>
+#include <algorithm>
+#include <complex>
+#include <random>
+#include <stdexcept>
+#include <string>
+
+// calculate the lowest n_states eigenpairs of a hermitian operator of dimension n that is only available through its \
+   action on a block of vectors: apply(X,Y) should set Y = H*X. a block lanczos iteration with full reorthogonalization \
+   is used and the krylov subspace is grown until the residual of all requested ritz pairs is below tol relative to the \
+   largest ritz value. eigenvalues are returned in ascending order and eigenvectors are the columns of eigvec.
+template <typename apply_type>
+void lanczos_eig_sym(arma::vec& eigval, arma::cx_mat& eigvec, const apply_type& apply, const int n, const int n_states, \
+                     const int block_size = 4, const double tol = 1.e-10)
+{
+  if ((n_states <= 0) or (n_states > n)){
+    throw std::invalid_argument("lanczos_eig_sym: number of states should be in the range [1," + std::to_string(n) + "].");
+  }
+
+  // fixed seed so that the starting block, and therefore the results, are reproducible
+  std::mt19937 generator(1234);
+  std::normal_distribution<double> distribution(0,1);
+  auto random_block = [&](const int n_cols){
+    arma::cx_mat X(n,n_cols);
+    for (auto& x: X)
+    {
+      x = std::complex<double>(distribution(generator),distribution(generator));
+    }
+    return X;
+  };
+
+  // orthonormalize a block against the current krylov basis and itself. columns that vanish because they are in the span \
+     of the basis are replaced by random vectors.
+  auto orthonormalize = [&](arma::cx_mat X, const arma::cx_mat& basis){
+    arma::cx_mat Q, R;
+    for (int i_try=0; i_try<10; i_try++)
+    {
+      X = arma::normalise(X);
+      for (int i_pass=0; i_pass<2; i_pass++)
+      {
+        if (basis.n_cols > 0){
+          X -= basis*(basis.t()*X);
+        }
+      }
+      arma::qr_econ(Q,R,X);
+      const arma::uvec deficient = arma::find(arma::abs(R.diag()) < 1.e-8);
+      if (deficient.n_elem == 0){
+        return Q;
+      }
+      X = Q;
+      X.cols(deficient) = random_block(deficient.n_elem);
+    }
+    throw std::runtime_error("lanczos_eig_sym: could not extend the krylov basis.");
+  };
+
+  int capacity = std::min(n, std::max(2*n_states, n_states+20*block_size));
+  arma::cx_mat V(n,capacity); // krylov basis
+  arma::cx_mat T(capacity,capacity,arma::fill::zeros); // projection of the operator onto the krylov basis
+  int k = 0; // current dimension of the krylov basis
+
+  arma::cx_mat Q = orthonormalize(random_block(std::min(block_size,n)), V.head_cols(0));
+  arma::cx_mat W, R;
+  arma::vec theta;
+  arma::cx_mat S;
+
+  while (true)
+  {
+    const int p = Q.n_cols;
+    if (k+p > capacity){
+      capacity = std::min(n, 2*capacity);
+      V.resize(n,capacity);
+      T.resize(capacity,capacity);
+    }
+    V.cols(k,k+p-1) = Q;
+    apply(Q,W);
+
+    // project the new block on the whole basis (twice) which gives the new block column of T and keeps the basis orthogonal
+    const int k_new = k+p;
+    arma::cx_mat C = V.head_cols(k_new).t()*W;
+    W -= V.head_cols(k_new)*C;
+    arma::cx_mat C_correction = V.head_cols(k_new).t()*W;
+    W -= V.head_cols(k_new)*C_correction;
+    C += C_correction;
+    T(arma::span(0,k_new-1),arma::span(k,k_new-1)) = C;
+    T(arma::span(k,k_new-1),arma::span(0,k_new-1)) = C.t();
+    k = k_new;
+
+    arma::cx_mat T_k = T(arma::span(0,k-1),arma::span(0,k-1));
+    arma::eig_sym(theta, S, arma::cx_mat(0.5*(T_k+T_k.t())));
+
+    // the ritz pairs are exact when the krylov subspace covers the whole space
+    if (k >= n){
+      break;
+    }
+
+    // residual norm of each ritz pair is the norm of R times the last block of its ritz vector
+    arma::qr_econ(Q,R,W);
+    if (k >= n_states){
+      const double scale = arma::abs(theta).max();
+      bool converged = true;
+      for (int i=0; i<n_states; i++)
+      {
+        if (arma::norm(R*S(arma::span(k-p,k-1),i)) > tol*scale){
+          converged = false;
+          break;
+        }
+      }
+      if (converged){
+        break;
+      }
+    }
+
+    Q = orthonormalize(W.head_cols(std::min(block_size,n-k)), V.head_cols(k));
+  }
+
+  eigval = theta.head(n_states);
+  eigvec = V.head_cols(k)*S.head_cols(n_states);
+};
+
+#endif //_lanczos_hpp_
@@ -0,0 +1,86 @@
+#ifndef _partial_eig_sym_hpp_
+#define _partial_eig_sym_hpp_
+
+#include <armadillo>
+#include <complex>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// lapack routine to calculate selected eigenvalues and eigenvectors of a complex hermitian matrix using the MRRR algorithm
+extern "C" void zheevr_(const char* jobz, const char* range, const char* uplo, const int* n, std::complex<double>* a, const int* lda,
+                        const double* vl, const double* vu, const int* il, const int* iu, const double* abstol, int* m, double* w,
+                        std::complex<double>* z, const int* ldz, int* isuppz, std::complex<double>* work, const int* lwork,
+                        double* rwork, const int* lrwork, int* iwork, const int* liwork, int* info);
+
+// calculate the lowest n_states eigenpairs of the hermitian matrix H that have eigenvalues below max_energy. use \
+   n_states<=0 to get all states below max_energy and max_energy=inf to get the lowest n_states regardless of their energy. \
+   eigenvalues are returned in ascending order and eigenvectors are the columns of eigvec.
+inline void partial_eig_sym(arma::vec& eigval, arma::cx_mat& eigvec, const arma::cx_mat& H, const int n_states, \
+                            const double max_energy = std::numeric_limits<double>::infinity())
+{
+  if (H.n_rows != H.n_cols){
+    throw std::invalid_argument("partial_eig_sym: input matrix should be square.");
+  }
+
+  int n = H.n_rows;
+  arma::cx_mat A = H; // zheevr destroys the input matrix
+
+  const char jobz = 'V';
+  const char uplo = 'L';
+  char range = 'A';
+  int il = 1, iu = n;
+  double vl = -std::numeric_limits<double>::max(), vu = max_energy;
+  if ((n_states > 0) and (n_states < n)){
+    range = 'I';
+    iu = n_states;
+  } else if (max_energy < std::numeric_limits<double>::infinity()){
+    range = 'V';
+  }
+  const double abstol = 0; // use the default tolerance of lapack
+
+  int n_cols = (range == 'I') ? iu-il+1 : n;
+  int m = 0;
+  arma::vec w(n);
+  arma::cx_mat Z(n, std::max(n_cols,1));
+  std::vector<int> isuppz(2*std::max(n_cols,1));
+  int info = 0;
+
+  // workspace query
+  int lwork = -1, lrwork = -1, liwork = -1;
+  std::complex<double> work_size;
+  double rwork_size;
+  int iwork_size;
+  zheevr_(&jobz, &range, &uplo, &n, A.memptr(), &n, &vl, &vu, &il, &iu, &abstol, &m, w.memptr(), Z.memptr(), &n, isuppz.data(),
+          &work_size, &lwork, &rwork_size, &lrwork, &iwork_size, &liwork, &info);
+
+  lwork = int(std::real(work_size));
+  lrwork = int(rwork_size);
+  liwork = iwork_size;
+  std::vector<std::complex<double>> work(lwork);
+  std::vector<double> rwork(lrwork);
+  std::vector<int> iwork(liwork);
+
+  zheevr_(&jobz, &range, &uplo, &n, A.memptr(), &n, &vl, &vu, &il, &iu, &abstol, &m, w.memptr(), Z.memptr(), &n, isuppz.data(),
+          work.data(), &lwork, rwork.data(), &lrwork, iwork.data(), &liwork, &info);
+
+  if (info != 0){
+    throw std::runtime_error("partial_eig_sym: zheevr failed with info = " + std::to_string(info));
+  }
+
+  // drop the states above max_energy when only the number of states was passed to lapack
+  while ((m > 0) and (w(m-1) > max_energy)){
+    m--;
+  }
+
+  if (m == 0){
+    eigval.reset();
+    eigvec.reset();
+    return;
+  }
+  eigval = w.head(m);
+  eigvec = Z.head_cols(m);
+};
+
+#endif //_partial_eig_sym_hpp_
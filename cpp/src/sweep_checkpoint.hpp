@@ -0,0 +1,136 @@
+#ifndef _sweep_checkpoint_hpp_
+#define _sweep_checkpoint_hpp_
+
+#include <cstdio>
+#include <ctime>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <unistd.h>
+
+// append-only text file that records the result of each finished point of a sweep as a line of the form \
+   "index value_1 value_2 ...". lines are flushed as soon as they are written and the file is synced to disk at most every \
+   sync_interval seconds, so a sweep that is killed only loses the points that were running. in the resume mode the \
+   records of a previous run are read back and new records are appended to the same file. the signature describes the \
+   inputs that the values depend on and is stored in the header, a previous run with a different signature is not resumed.
+class sweep_checkpoint
+{
+private:
+  std::FILE* _file = nullptr;
+  std::map<int,std::vector<double>> _records; // records of a previous run in the form (index, values)
+  std::mutex _mutex; // lock to write to the file from several threads
+  std::time_t _last_sync; // time of the last sync to disk
+  double _sync_interval; // minimum time between syncs to disk in seconds
+
+  // write a record with enough digits to read the values back exactly
+  void write(const int& index, const std::vector<double>& values)
+  {
+    std::fprintf(_file, "%d", index);
+    for (const auto& value: values)
+    {
+      std::fprintf(_file, " %.17g", value);
+    }
+    std::fprintf(_file, "\n");
+  };
+
+public:
+  sweep_checkpoint(const std::string& filename, const std::string& header, const std::string& signature, const bool& resume, \
+                   const double& sync_interval = 10)
+  {
+    _sync_interval = sync_interval;
+
+    const std::string signature_line = "# signature " + signature;
+    if (resume){
+      std::ifstream input(filename);
+      std::string line;
+      bool is_same_signature = false;
+      while (std::getline(input, line))
+      {
+        // the last line is incomplete if the previous run was killed while writing it
+        if (input.eof()){
+          break;
+        }
+        if (line.rfind("# signature ", 0) == 0){
+          is_same_signature = (line == signature_line);
+          continue;
+        }
+        if (line.empty() or line[0] == '#'){
+          continue;
+        }
+        if (not is_same_signature){
+          throw std::runtime_error("sweep_checkpoint: " + filename + " was written for different inputs than \"" + signature + \
+                                   "\", remove it or turn off resume!!!");
+        }
+        std::istringstream stream(line);
+        int index;
+        std::vector<double> values;
+        double value;
+        if (not (stream >> index)){
+          continue;
+        }
+        while (stream >> value)
+        {
+          values.push_back(value);
+        }
+        _records[index] = values;
+      }
+    }
+
+    // the file is rewritten with the valid records of the previous run, which also drops a line that was cut off. the \
+       new file is written next to the old one and renamed over it so that the old records are never lost.
+    const std::string tmp_filename = filename + ".tmp";
+    _file = std::fopen(tmp_filename.c_str(), "w");
+    if (_file == nullptr){
+      throw std::runtime_error("sweep_checkpoint: could not open " + tmp_filename);
+    }
+    std::fprintf(_file, "%s\n", signature_line.c_str());
+    std::fprintf(_file, "# index %s\n", header.c_str());
+    for (const auto& record: _records)
+    {
+      write(record.first, record.second);
+    }
+    std::fflush(_file);
+    fsync(fileno(_file));
+    if (std::rename(tmp_filename.c_str(), filename.c_str()) != 0){
+      throw std::runtime_error("sweep_checkpoint: could not rename " + tmp_filename + " to " + filename);
+    }
+    _last_sync = std::time(nullptr);
+  };
+
+  sweep_checkpoint(const sweep_checkpoint&) = delete;
+  sweep_checkpoint& operator=(const sweep_checkpoint&) = delete;
+
+  ~sweep_checkpoint()
+  {
+    if (_file != nullptr){
+      std::fflush(_file);
+      fsync(fileno(_file));
+      std::fclose(_file);
+    }
+  };
+
+  // records read from a previous run in the form (index, values)
+  const std::map<int,std::vector<double>>& records() const
+  {
+    return _records;
+  };
+
+  // append the values of a finished point
+  void append(const int& index, const std::vector<double>& values)
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    write(index, values);
+    std::fflush(_file);
+
+    if (std::difftime(std::time(nullptr), _last_sync) >= _sync_interval){
+      fsync(fileno(_file));
+      _last_sync = std::time(nullptr);
+    }
+  };
+};
+
+#endif //_sweep_checkpoint_hpp_